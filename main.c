@@ -4,6 +4,14 @@
 #include <SDL.h>
 #include <math.h>
 #include <time.h>
+#include <string.h>
+#include "vecmath.h"
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HAS_AVX_KERNELS //functions marked with AVX_TARGET are only called after SDL_HasAVX says the cpu supports them
+#define AVX_TARGET __attribute__((target("avx")))
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
 
 static int WIDTH = 1920; //640
 static int HEIGHT = 1080; //360
@@ -25,6 +33,100 @@ static float FRUSTUM_WIDTH = 1.0; // = 1/tan(fov/2)
 static float FRUSTUM_NEAR_LENGTH = 0.01;
 static int DRAW_EDGES = false;
 
+static int WINDOW_WIDTH = 1920; //WIDTH and HEIGHT are the internal render resolution, which is upscaled to the window on present
+static int WINDOW_HEIGHT = 1080;
+static int DYNAMIC_RESOLUTION = true;
+static float MIN_RENDER_SCALE = 0.5;
+static float MAX_RENDER_SCALE = 1.0;
+static float TARGET_RASTER_TIME = 12.0; //milliseconds per frame spent clearing and filling faces
+static int SPAN_BUFFER = false; //draw front to back, only filling the parts of each row nothing closer has covered, edges aren't drawn in this mode
+static int PIPELINED = false; //step the player and entities on their own thread, a tick ahead of the one being drawn
+static int REUSE_FRAMES = true; //present the last frame again instead of redrawing it when nothing in view has moved, needs render to texture
+static int INDEXED_FRAMEBUFFER = false; //draw palette indexes into a byte per pixel buffer, expanded to colour in one pass when the frame is presented
+static int OCCLUSION_CULL = true; //skip faces and instances hidden behind the map's faces, tested against a low resolution depth buffer before anything is transformed for drawing
+static int RENDER_STATS = false; //show what each frame drew and culled in the window title
+static char STATS_FILE[40] = ""; //if set, the same counts are written to this file as csv, one line per frame
+static int OVERDRAW_VIEW = false; //colour each pixel by how many times it was written instead of what was written, draws through the indexed framebuffer
+static int MERGE_FACES = true; //join flat faces in the same plane with the same colour into convex polygons when the map is loaded, so each is culled, sorted and filled once
+static int LATE_LATCH = true; //turn the view by mouse movement that arrived while the tick was being stepped, just before drawing, the movement goes into the next tick
+static int JOB_THREADS = 0; //threads drawFilledFaces splits culling, depth keys and projection over, counting the main thread, 0 for one per core the other threads don't use
+
+#define RESOLUTION_HISTORY 8 //number of frames the raster time is averaged over before the scale is changed
+#define FRAME_TIME 16 //ms each frame is paced to, outside of replays
+#define LATCH_EVENTS 32 //mouse events taken off the queue at a time when late latching
+#define LATENCY_EVENTS 256 //mouse events timed until a present shows them, any more waiting at once aren't counted
+#define LATENCY_BUCKETS 256 //the latency histogram has a bucket per ms, anything slower goes in the last one
+
+#define ARENA_ALIGN 32 //alignment of every arena allocation, enough for AVX loads
+#define FRAME_ARENA_SIZE (1 << 20) //starting size, the frame arena grows on reset if a frame needed more
+
+#define COLLISION_EPSILON 0.001
+#define PLAYER_RADIUS 100.0 //how far the player is kept from walls
+
+#define ENTITY_GRAVITY 0.5
+#define ENTITY_CLIP_ITERATIONS 16
+#define ENTITY_PUSH 0.2 //fraction of the overlap between two entities they move apart by each tick
+#define ENTITY_SEED 1 //entities are placed from their own generator starting here, so the layout is the same every run whatever else has called rand()
+static int ENTITY_COUNT = 0;
+static float ENTITY_RADIUS = 60;
+#define CONTACT_CACHE_SIZE 256 //most faces the player's contact cache holds, a box with more than this falls back to searching every face
+#define CONTACT_REACH 300.0 //the contact cache box reaches this far past the ray it was filled for, so it lasts a few ticks of movement
+#define CONTACT_RECENT 4 //faces hit last tick that are tested before the rest of the cache
+#define MAX_CLIP_ITERATIONS 64 //prevent infinite loop in case something breaks badly, counted instead of timed so replays always clip the same way
+#define REPLAY_MAGIC "IIRL"
+#define REPLAY_VERSION 2
+#define CAPTURE_MAGIC "IIRF"
+#define CAPTURE_VERSION 1
+#define CAPTURE_SLOTS 4 //frames that can be waiting for the capture writer before new ones are dropped
+
+#define TRIPLE_BUFFER_FRESH 4 //set in tripleBuffer.middle when it holds a tick the renderer hasn't taken yet
+#define MAX_TEXTURE_THREADS 4 //most threads decoding textures at once while the map loads
+#define MAX_JOB_THREADS 16 //most threads in the job pool, counting the one that hands the work out
+#define JOB_MAX_CHUNKS 4096 //a parallel for is split into at most this many chunks, so a range of them fits in 16 bits each end
+#define JOB_GRAIN 64 //fewest faces handed out in a chunk of a parallel for
+#define PROJECT_BATCH 4096 //visible faces projected at a time ahead of filling, so the span buffer stopping early doesn't waste a whole frame's projection
+#define LOADING_BAR_HEIGHT 20
+#define TEXTURE_LOADING_GREY 128 //colour textured faces are filled with until their texture has been decoded
+#define CLUSTER_MAX_FACES 32
+#define CLUSTER_MIN_COS 0.9 //a face only joins a cluster if its normal is within about 25 degrees of the cluster's first face
+#define INDEXED_BLACK 0 //entries every indexed frame palette starts with
+#define INDEXED_EDGE_GREY 1
+#define INDEXED_LOADING_GREY 2
+#define INDEXED_MAP_COLOURS 3 //map colour i is entry INDEXED_MAP_COLOURS + i, texture colours are added after them
+#define OCCLUSION_WIDTH 128 //texels across the occlusion buffer, its height follows the render aspect ratio
+#define OCCLUSION_LEVELS 8
+#define OCCLUDER_MIN_AREA 8 //faces covering fewer occlusion texels than this aren't drawn into it
+#define OCCLUSION_BIAS 1.001 //anything tested has to be this much further than the buffer to be hidden, covers rounding in the depth plane
+#define COPLANAR_EPSILON 0.01 //how far apart two faces' planes can be, in world units, and still count as the same plane
+#define WELD_EPSILON 0.01 //map vertices are snapped to a grid this size when looking for duplicates, and the ones in the same cell become one
+#define DEGENERATE_AREA 0.01 //faces with less than this much area, in world units squared, are thrown away when the map is loaded
+#define MAX_POLYGON_POINTS 8 //most corners a merged polygon can have, clipping to the near plane can add one more
+#define SUBPIXEL_STEPS 16 //corners are snapped to this fraction of a pixel before filling, so faces sharing an edge walk it from exactly the same points
+#define OVERDRAW_COLOURS 8 //the overdraw view has a colour for 0 to 6 writes, anything written 7 or more times is white
+#define STATS_TITLE_INTERVAL 500 //ms between updates of the window title when render stats are shown
+#define GENERATED_ROOM_SIZE 1200 //rooms in generated maps are this wide and GENERATED_ROOM_HEIGHT tall
+#define GENERATED_ROOM_HEIGHT 800
+#define GENERATED_COLOURS 4
+#define BENCH_MAP_FILE "bench_map.txt" //generated maps are written here for loadMap to read, then deleted
+#define BENCH_MAX_FACES (1 << 20)
+#define BENCH_FRAMES 16 //views drawn of each map in the drawFilledFaces benchmark, turning all the way round
+#define BENCH_FRONT_END_FACES 65536 //smallest map in the drawFilledFaces benchmark, below this the per frame setup hides what the jobs save
+#define BENCH_MAX_SECONDS 2.0 //a benchmark stops going up in size once one run takes longer than this
+#define BENCH_PIXELS (1 << 24) //pixels covered at each triangle size, so every size does about the same work
+#define BENCH_RAYS 256 //player moves tested against every face of a map in the clipVelocity benchmark
+#define BENCH_WIDTH 1280
+#define BENCH_HEIGHT 720
+#define REGRESS_TOLERANCE 2 //how far apart a channel of a pixel and its reference can be before -regress counts it as different
+#define REGRESS_WIDTH 480 //-regress always draws at this size, so references don't depend on the window size in settings.txt
+#define REGRESS_HEIGHT 270
+#define REGRESS_FRUSTUM_WIDTH 0.7 //-regress draws with these instead of settings.txt's, the references were made with them
+#define REGRESS_FRUSTUM_NEAR_LENGTH 0.1
+#define REGRESS_JOB_THREADS 4 //threads the multithreaded paths are drawn with, whatever the machine has, so the split is always tested
+#define CLUSTER_GRID 128 //cells along each side of the map when sorting faces into clusters, 7 bits per axis so the whole key fits exactly in a float
+enum {LOAD_PARSING, LOAD_BUILDING, LOAD_READY}; //mapLoader stages, fields for a stage can be read once stage has reached it
+enum {CAPTURE_REPEAT, CAPTURE_INDEXED, CAPTURE_RGB, CAPTURE_END}; //what a captureSlot holds, the end marker stops the writer and isn't written
+enum {TEXEL_PALETTED, TEXEL_RGB24, TEXEL_RGB32, TEXEL_FORMATS}; //texture pixel formats textureTriangle has row kernels for
+
 
 
 int sign(float a);
@@ -34,22 +136,18 @@ float clamp(float a, float bot, float top);
 
 
 
-typedef struct //vec3
-{
-    float x,y,z;
-} vec3;
-
-typedef struct //vec2
-{
-    float x,y;
-} vec2;
-
 typedef struct //camera
 {
     vec3 pos, vel;
     float pitch, yaw, speed, accel, decel; //angle and yaw in radians
 } camera;
 
+typedef struct //view //the camera's position and rotation, worked out once a frame so moving a point into camera space is a subtract and a matrix multiply
+{
+    vec3 pos;
+    mat3 rotation;
+} view;
+
 typedef struct //face //each face is a triangle, with 3 indexes in the vertex array
 {
     int p1, p2, p3, texture, type, flags;
@@ -57,96 +155,702 @@ typedef struct //face //each face is a triangle, with 3 indexes in the vertex ar
     vec2 uv1, uv2, uv3;
 } face;
 
+typedef struct //faceCluster //faces close together with similar normals, so a group that's all facing away is skipped with one test
+{
+    vec3 centre, axis; //bounding sphere centre, normalised average of the face normals
+    float radius;
+    float cutoff; //sine of the widest angle between axis and a face normal, 2 if they spread too far for the cluster to ever be culled
+    int first, n; //the cluster's faces are clusterFaces[first] to clusterFaces[first + n - 1]
+} faceCluster;
+
+typedef struct //faceTable //the map's faces, split so the loops that go over every face only pull in the fields they read
+{
+    int n;
+    int *indices; //hot: p1, p2, p3 of each face packed together
+    float *planes; //hot: norm.x, norm.y, norm.z, dot(p1, norm) of each face
+    int *flags; //hot
+    int *occluderPair; //hot: a face in the same plane sharing an edge, which together with this one makes a convex quad for the occlusion buffer, -1 if there isn't one
+    int *polygonStart; //hot: face i is drawn as polygonPoints[polygonStart[i]] to polygonPoints[polygonStart[i + 1] - 1], none if it was merged into another face's polygon
+    int *polygonPoints; //vertex indexes of each polygon in the faces' winding order, just the face's own corners if nothing was merged into it
+    int nPolygons; //faces that have a polygon, only these are in the clusters
+    int *texture, *type; //cold, only read once a face is being drawn
+    vec2 *uvs; //cold: uv1, uv2, uv3 of each face
+    int nClusters;
+    faceCluster *clusters; //made by buildFaceClusters once every face is in
+    int *clusterFaces; //every face index once, grouped by cluster
+} faceTable;
+
 typedef struct //colour
 {
     int r,g,b;
 } colour;
 
-float length(vec3 a);
-float dot(vec3 a, vec3 b);
-
-vec3 add(vec3 a, vec3 b);
-vec3 sub(vec3 a, vec3 b);
-vec3 mul(vec3 a, float b);
-vec3 unit(vec3 a);
-vec3 cross(vec3 a, vec3 b);
-vec3 rotate(vec3 a, vec3 b, float theta);
-vec3 rotateZ(vec3 a, float theta);
-vec3 rotateX(vec3 a, float theta);
-vec3 dropX(vec3 a);
-vec3 dropY(vec3 a);
-vec3 dropZ(vec3 a);
-
-vec2 add2(vec2 a, vec2 b);
-vec2 sub2(vec2 a, vec2 b);
-vec2 mul2(vec2 a, float b);
-float length2(vec2 a);
-float dot2(vec2 a, vec2 b);
-vec2 unit2(vec2 a);
-vec3 toVec3(vec2 a, float z);
+typedef struct arenaSpill //arenaSpill //heap block used when an arena runs out of room, freed on the next reset
+{
+    struct arenaSpill *next;
+} arenaSpill;
+
+typedef struct //arena //linear allocator for scratch memory, everything in it is released at once by arenaReset
+{
+    char *block, *memory; //block is what was malloced, memory is block rounded up to ARENA_ALIGN
+    size_t size, used, wanted; //wanted counts spilled allocations too, so the next reset can grow the arena to fit them
+    arenaSpill *spilled;
+} arena;
+
+typedef struct collisionTable //collisionTable //per face collision data worked out at load, one array per field so 8 faces can be tested at once
+{
+    int n, nPadded; //nPadded is n rounded up to a multiple of 8, the padding faces have a zero normal so they never get hit
+    float *nx, *ny, *nz; //face normal
+    float *planeD; //dot(p1, norm)
+    float *hx, *hy, *hn; //unit(dropZ(norm)) and its dot with the normal, the ray is pushed radius * -h out from the face before testing
+    float *px, *py, *pz; //p1
+    float *t2x, *t2y, *t2z, *t3x, *t3y, *t3z; //triangle edges p2 - p1 and p3 - p1
+    float *d22, *d23, *d33, *invBot; //edge dot products and the inverse of the barycentric denominator
+    float *minX, *maxX, *minY, *maxY, *minZ, *maxZ; //bounding box of each face for the broadphase
+    int *sortedX; //face indexes sorted by minX
+    float *reachX; //largest maxX of the faces up to each place in sortedX, so a box can binary search past the faces that end before it
+    float slack; //furthest a hit can land outside its face's bounding box, from the barycentric epsilon, plus a unit for rounding
+    int (*findHit)(struct collisionTable *table, vec3 origin, vec3 vel, float radius, float *hitD); //scalar or AVX version, picked when the table is built
+} collisionTable;
+
+typedef struct //contactCache //faces near the player from the broadphase, tested instead of the whole table until the player's ray leaves the box they were gathered from
+{
+    int *faces; //in index order, so ties between faces go the same way as in a full search
+    int n; //-1 when the box had more than CONTACT_CACHE_SIZE faces in it, every ray searches the whole table until it's filled again
+    bool filled;
+    vec3 low, high; //box the faces were gathered from
+    float reach; //how far past the ray the box goes, cut down while it has too many faces in it and grown back once they fit easily
+    int recent[CONTACT_RECENT]; //faces hit in the last tick, usually the floor and whatever wall is being slid along
+    int nRecent;
+} contactCache;
+
+typedef struct //mesh //geometry shared by everything that uses it, vertices are relative to the mesh origin
+{
+    int nVectors, nFaces;
+    vec3 *vectors;
+    face *faces;
+    float radius; //distance from the origin to the furthest vertex
+} mesh;
+
+typedef struct //meshInstance //a mesh placed in the world for a frame of drawing
+{
+    int mesh;
+    vec3 pos;
+    float yaw, scale;
+} meshInstance;
+
+typedef struct //entityStore //every moving object apart from the player, one array per field so the update pass streams straight through
+{
+    int n;
+    float *px, *py, *pz, *vx, *vy, *vz;
+    float *radius; //bounding sphere, used for culling, the broadphase and entity to entity contacts
+    int *mesh; //index into the mesh list
+    float *lo, *hi; //x interval the entity can reach this tick
+    int *order; //entity indexes sorted by lo, kept between ticks so the insertion sort has almost nothing to do
+} entityStore;
+
+typedef struct //spanBuffer //the parts of each row that have been drawn this frame, so faces drawn front to back never overdraw
+{
+    int width, height;
+    int *nSpans, *capacity; //per row
+    int **spans; //per row, start and end (inclusive) pairs sorted by start, touching spans are merged
+    int *pieces; //the uncovered pieces found by the last coverSpan, same layout
+    int rowsLeft; //rows that still have a gap somewhere
+    arena *scratch; //rows that run out of room get a bigger array from here
+} spanBuffer;
+
+typedef struct //polygonScan //the two sides of a convex polygon on screen, walked down a row at a time by scanRow
+{
+    vec2 *points;
+    int n, bottom;
+    int side[2]; //start corner of the edge each side is on, side 0 goes forwards round the points and side 1 backwards
+    int y, endY; //next row, and the row after the last one the polygon covers
+} polygonScan;
+
+typedef struct //indexedFrame //byte per pixel framebuffer of palette indexes, expanded to 32 bit colour in one pass when it's presented
+{
+    int width, height; //allocated size, rows are width bytes apart and only the top left WIDTH x HEIGHT is drawn each frame
+    Uint8 *pixels;
+    Uint32 palette[256]; //RGB888 colour of each index
+    int nPalette; //entries used so far, each texture's colours are added the first time it's drawn
+    Uint8 (*textureRemap)[256]; //per texture, its own palette index to the frame's
+    bool *remapped; //per texture, whether textureRemap has been filled in yet
+    int nTextures;
+    Uint8 colour; //what fillTriangle and drawClippedLine draw with, set alongside SDL_SetRenderDrawColor
+    SDL_Texture *texture; //streaming texture the frame is expanded into
+    void (*resolveRow)(Uint8 *src, Uint32 *dst, Uint32 *palette, int n);
+    bool overdraw; //pixels count how many times they've been written instead, and the palette is a heat map of the count
+} indexedFrame;
+
+typedef struct //textureRaster //what the textured row kernels read, worked out once a triangle so their loops only have the per pixel work left in them
+{
+    Uint8 *pixels; //the texture's, only valid while it's locked
+    int pitch;
+    float maxX, maxY; //last texel across and down, coords are clamped to them
+    float mA, mB, mC, mD; //screen position relative to origin to triangle leg coords
+    vec2 origin, tOrigin, tU, tV;
+    SDL_Color *palette; //paletted textures' colours
+    Uint8 *remap; //paletted textures' indexes to the indexed frame's
+    Uint32 rMask, gMask, bMask; //where each channel is in a 24 or 32 bit texel
+    int rShift, gShift, bShift;
+    SDL_Renderer *renderer;
+    indexedFrame *indexed;
+    int runStart; //first pixel of the run of one colour the renderer kernels haven't drawn yet
+    Uint32 runColour; //its colour as 0xAARRGGBB
+} textureRaster;
+
+typedef void (*textureRowFunction)(textureRaster *t, int y, int x1, int x2); //x1 to x2 inclusive of row y, all on screen
+
+typedef struct //occlusionBuffer //low resolution depth of the faces in view, each level of the pyramid keeps the furthest depth of 2x2 texels of the one below
+{
+    int nLevels;
+    int width[OCCLUSION_LEVELS], height[OCCLUSION_LEVELS];
+    float *depth[OCCLUSION_LEVELS]; //view space y, nothing in front of a texel is further than its value, INFINITY where nothing covers it
+    float scale; //texels per screen pixel
+} occlusionBuffer;
+
+typedef struct //renderStats //counts of what one frame did, cleared before it's drawn
+{
+    int facesTested; //every map face and every instance face, the culled counts below are out of this
+    int backfaceCulled; //facing away, on their own or with their whole cluster
+    int frustumCulled; //behind the near plane, or part of an instance outside the view
+    int occlusionCulled;
+    int facesDrawn; //made it to the screen, after the span buffer has stopped early if it did
+    int nearClipped; //drawn faces with a corner behind the near plane
+    int trianglesRasterized;
+    int pixelsRasterized; //every write, so this over WIDTH * HEIGHT is the average overdraw
+    int clipIterations; //times the player's velocity went round the collision loop in the tick that was drawn
+} renderStats;
+
+typedef struct //tickInput //everything the player controls in one tick, this is all that gets recorded for replays
+{
+    Uint16 keys; //wasd bits in the low 5 bits, arrows bits above that
+    Sint16 xrel, yrel; //mouse movement summed over the tick
+} tickInput;
+
+typedef struct //frameSnapshot //everything drawing needs from one tick, not changed again until the renderer hands the slot back
+{
+    camera player;
+    meshInstance *instances; //the map's instances, then one per entity
+    int nInstances;
+    int clipIterations; //from stepping the player to this tick
+    int inputsTaken; //how many frames of the main thread's input had been handed to the simulation by this tick
+} frameSnapshot;
+
+typedef struct //tripleBuffer //lock free hand over of snapshots from the simulation to the renderer, each side only touches its own slot
+{
+    frameSnapshot slots[3];
+    SDL_atomic_t middle; //slot waiting between the two, plus TRIPLE_BUFFER_FRESH if it's newer than the one the renderer has
+    int back, front; //slot the simulation is writing, slot the renderer is reading
+    SDL_sem *published, *taken; //posted after each publish and take so a replay can sleep until the other side is done, never counted past 1
+} tripleBuffer;
+
+typedef struct //simulation //the player and entities, stepped by simulateTick either on the main thread or on its own one
+{
+    camera player;
+    collisionTable *collision;
+    entityStore *entities;
+    mesh *meshes;
+    meshInstance *mapInstances;
+    int nMapInstances;
+    arena tickArena; //scratch for one tick, separate from the renderer's frame arena
+    int clipIterations; //from the last stepPlayer
+    contactCache contacts;
+    tripleBuffer frames;
+    FILE *replayFile, *recordFile;
+    SDL_atomic_t keys, xrel, yrel; //input from the main thread for the simulation thread, mouse movement is summed until a tick takes it
+    SDL_atomic_t inputsSent; //frames of input the main thread has added to those, set after the movement so a tick that reads it first has all of it
+    int inputsTaken; //inputsSent as the last tick read it
+    SDL_atomic_t running; //cleared by the main thread to stop the simulation thread, or by the simulation thread when the replay ends
+} simulation;
+
+typedef void (*jobFunction)(void *data, int first, int last, int thread); //does items first to last - 1, thread is 0 on the thread that called parallelFor and 1 up on the workers
+
+typedef struct //jobRange //the chunks of a parallel for one thread has left, its owner takes them from the front and other threads steal half from the back
+{
+    SDL_atomic_t range; //next chunk in the low 16 bits, end in the high 16
+    char pad[60]; //keeps each thread's range on its own cache line
+} jobRange;
+
+typedef struct //jobPool //worker threads that sleep until parallelFor hands them a job, the thread calling it works on the job too
+{
+    int nThreads; //workers plus the calling thread
+    SDL_Thread *threads[MAX_JOB_THREADS];
+    SDL_sem *start, *done; //posted once per worker to start a job, and by each worker when it runs out of chunks
+    SDL_atomic_t nextThread; //hands out worker numbers as they start
+    jobRange ranges[MAX_JOB_THREADS];
+    jobFunction function;
+    void *data;
+    int n, chunk; //items in the job and items per chunk
+    bool quit;
+} jobPool;
+
+typedef struct //projectedFace //a face's corners in view space and on screen, clipped to the near plane, worked out for a batch of faces before any of them are filled
+{
+    vec3 pointsR[MAX_POLYGON_POINTS];
+    vec2 pointsOut[MAX_POLYGON_POINTS + 1]; //clipping a polygon against the near plane adds at most 1 point
+    int from[MAX_POLYGON_POINTS + 1], to[MAX_POLYGON_POINTS + 1]; //each point out is along the edge from one corner to another, from == to for a corner that wasn't clipped
+    float along[MAX_POLYGON_POINTS + 1]; //how far, 0 at from and 1 at to
+    int nCorners, nPoints; //before and after clipping
+    bool clipped; //a corner was behind the near plane
+    bool onScreen; //false if every corner is off the same side of the screen
+} projectedFace;
+
+typedef struct //frontEnd //what the jobs drawFilledFaces splits its work into read and write, each job only writes its own items so the output can be packed in order afterwards
+{
+    faceTable *faces;
+    vec3 *points, *instPoints;
+    face *instFaces;
+    int nFaces; //map faces, indexes in facesIndex from here up are instance faces
+    view eye;
+    int *clusterVisible; //each cluster's faces that are left after culling, starting at the cluster's first entry in clusterFaces
+    int *clusterCount; //how many of those there are, -1 if the whole cluster was culled
+    bool *instVisible;
+    int *facesIndex, nVisible;
+    float *dist;
+    projectedFace *projected;
+    int batchStart; //draw order position of projected[0]
+    int backfaceCulled[MAX_JOB_THREADS], frustumCulled[MAX_JOB_THREADS]; //per thread, added to the frame's stats once every job is done
+} frontEnd;
+
+typedef struct //captureSlot //a frame waiting for the capture writer, or being written by it
+{
+    int kind;
+    Uint8 *pixels; //indexed frames swap this with the indexedFrame's pixels instead of copying, so it's the same size as those
+    int pitch; //bytes between rows
+    Uint32 palette[256]; //indexed frames only
+    int frame, width, height;
+} captureSlot;
+
+typedef struct //frameCapture //finished frames handed to a writer thread through a ring of slots allocated up front, nothing is allocated or waited on while drawing
+{
+    FILE *file;
+    captureSlot slots[CAPTURE_SLOTS];
+    int head, tail; //next slot the render thread fills, next slot the writer takes
+    SDL_sem *empty, *filled; //slots free to fill, slots waiting to be written
+    SDL_Thread *thread;
+    Uint8 *packed; //writer's run length encoding of an indexed frame
+    bool haveLast; //the last frame that was drawn made it into a slot, so a reused frame can be written as a repeat
+    int nWritten, nDropped;
+    bool failed; //a write went wrong, nothing more is written
+    double renderTime; //ms spent in captureFrame on the render thread
+} frameCapture;
+
+typedef struct //generatedMap //a test map made by one of the generators, written out in the map file format
+{
+    camera player;
+    vec3 *vectors;
+    int nVectors, maxVectors;
+    int *faces; //p1, p2, p3, colour, type of each face
+    int nFaces, maxFaces;
+} generatedMap;
+
+typedef struct //mapLoader //the map is read and built on other threads so the window can show something straight away
+{
+    SDL_atomic_t stage; //LOAD_PARSING until the file has been read, LOAD_BUILDING while the collision table and entities are made, then LOAD_READY
+    SDL_atomic_t nextTexture; //next texture a decoding thread should take
+    SDL_atomic_t nTexturesDone; //decoded (or failed) so far, textures[i] is only set after it's been counted as taken
+    char *fileName;
+    Uint32 startTime;
+
+    //LOAD_BUILDING
+    camera player;
+    int nVectors, nColours, nTextures, nMeshes, nInstances;
+    vec3 *vectors;
+    faceTable faces;
+    colour *colours;
+    char **textureNames;
+    SDL_Surface **textures; //entries stay NULL until decoded, read them with SDL_AtomicGetPtr while nTexturesDone < nTextures
+    mesh *meshes; //the map's own meshes
+    meshInstance *instances;
+
+    //LOAD_READY
+    arena loadArena; //everything below lives in here
+    collisionTable collision;
+    mesh *allMeshes; //the map's meshes, then the entity mesh
+    entityStore entities;
+
+    SDL_Thread *thread;
+    SDL_Thread *textureThreads[MAX_TEXTURE_THREADS];
+    int nTextureThreads;
+} mapLoader;
+
 vec2 perspective2d(vec3 a);
 
 bool intersection(vec2 a1, vec2 a2, vec2 b1, vec2 b2, vec2 *result);
 
 void loadConstants(int *w, int *h, float *sens, char *map, float *frustumW, float *frustumN, int *edges, char* fileName);
+void loadOptionalSetting(char *key, char *value);
+void setRenderScale(float scale);
+void writeStatsHeader(FILE *file);
+void writeStats(FILE *file, int frame, float rasterTime, bool reused, renderStats *stats);
+void showStats(SDL_Window *window, renderStats *stats);
+float updateRenderScale(float scale, float rasterTime, float *history, int *nHistory);
 void quicksort(int list[], float ref[], int l, int r);
-void drawFilledFaces(face *faces, int nFaces, camera player, vec3 *points, SDL_Renderer *renderer, colour *colours, SDL_Surface **textures);
+void drawFilledFaces(faceTable *faces, camera player, vec3 *points, SDL_Renderer *renderer, colour *colours, SDL_Surface **textures, mesh *meshes, meshInstance *instances, int nInstances, arena *frameArena, indexedFrame *indexed, jobPool *jobs, renderStats *stats);
+void cullClustersJob(void *data, int first, int last, int thread);
+void cullInstanceFacesJob(void *data, int first, int last, int thread);
+void faceDepthJob(void *data, int first, int last, int thread);
+void projectFacesJob(void *data, int first, int last, int thread);
+int visiblePolygon(frontEnd *fe, int index, int *corners, int **polygon, vec3 **points);
+view cameraView(camera player);
+vec3 toView(view *eye, vec3 p);
+bool faceVisible(int *polygon, int n, vec3 norm, float planeD, vec3 *points, view *eye);
+float faceDepth(int *polygon, int n, vec3 *points, view *eye);
+bool instanceVisible(meshInstance instance, float radius, view *eye);
+bool sameView(camera a, camera b);
+int placeInstance(mesh m, meshInstance instance, face *outFaces, vec3 *outPoints, int *nOutPoints);
+vec3 instancePoint(meshInstance instance, vec3 p);
+mat4 instanceMatrix(meshInstance instance);
 void drawLine(vec3 p1, vec3 p2, SDL_Renderer *render);
-void drawWireframeFace(face f, camera player, vec3 *points, SDL_Renderer *render);
-void loadMap(int *nVectors, int *nFaces, int *nColours, vec3 **vectors, face **faces, colour **colours, char *fileName, camera *player, SDL_Surface ***textures, int *nTextures);
-void transformFace(face f, vec3 *points, camera player, SDL_Renderer *renderer, SDL_Surface **textures);
-void drawWireframePolygon(vec2 *polygon, int nPoints, SDL_Renderer *renderer);
-void fillTriangle(vec2 p1, vec2 p2, vec2 p3, SDL_Renderer *renderer);
+void drawWireframeFace(faceTable *faces, int i, view *eye, vec3 *points, SDL_Renderer *render);
+void loadMap(int *nVectors, int *nColours, vec3 **vectors, faceTable *faces, colour **colours, char *fileName, camera *player, char ***textureNames, int *nTextures, int *nMeshes, mesh **meshes, int *nInstances, meshInstance **instances);
+bool readFace(FILE *file, face *f, vec3 *vectors, int nVectors);
+vec3 orientNormal(vec3 norm, vec3 mid, int type);
+bool generateMap(generatedMap *m, char *kind, int nFaces);
+bool writeGeneratedMap(generatedMap *m, char *fileName);
+void freeGeneratedMap(generatedMap *m);
+int genVector(generatedMap *m, vec3 v);
+void genFace(generatedMap *m, int p1, int p2, int p3, int colour, vec3 facing);
+void genQuad(generatedMap *m, vec3 a, vec3 b, vec3 c, vec3 d, int colour, vec3 facing);
+void generateSphere(generatedMap *m, int nFaces);
+void generateRooms(generatedMap *m, int nFaces);
+void generateSoup(generatedMap *m, int nFaces);
+int runBenchmarks(int maxFaces);
+int runRegression(char *caseFile, int tolerance, bool update);
+void drawRegressionCase(mapLoader *map, camera player, SDL_Renderer *renderer, indexedFrame *indexed, jobPool *jobs, arena *frameArena);
+int compareImages(SDL_Surface *image, SDL_Surface *reference, int tolerance, SDL_Surface *diff, int *maxDifference, indexedFrame *indexed);
+int colourDifference(Uint32 a, Uint32 b);
+double benchTime(Uint64 start);
+void benchRaster(void);
+void benchQuicksort(int maxFaces);
+void benchMaps(int maxFaces);
+bool clipVelocity(camera *player, faceTable *faces, int i, vec3 *points);
+void benchDrawFaces(int maxFaces);
+void startMapLoad(mapLoader *l, char *fileName);
+int loadMapThread(void *data);
+int loadTexturesThread(void *data);
+void finishMapLoad(mapLoader *l);
+void freeMap(mapLoader *l);
+float loadProgress(mapLoader *l);
+void drawLoadingBar(SDL_Renderer *renderer, int y, float progress);
+bool faceTableInit(faceTable *t, int n);
+bool faceTableReserve(faceTable *t, int capacity);
+void faceTableFree(faceTable *t);
+void setFace(faceTable *t, int i, face f, vec3 *vectors);
+face getFace(faceTable *t, int i);
+vec3 faceNormal(faceTable *t, int i);
+void buildFaceClusters(faceTable *t, vec3 *vectors, int nVectors);
+void pairOccluderFaces(faceTable *t, vec3 *vectors, int nVectors);
+int occluderPolygon(faceTable *t, int i, int *polygon);
+bool vertexFaces(faceTable *t, int nVectors, int **start, int **list);
+int weldVectors(vec3 *vectors, int nVectors, faceTable *t);
+void removeDegenerateFaces(faceTable *t, vec3 *vectors);
+void splitTJunctions(faceTable *t, vec3 *vectors, int nVectors);
+int vertexOnEdge(vec3 *vectors, int *sortedX, float *keys, int nVectors, int a, int b);
+void mergeFacePolygons(faceTable *t, vec3 *vectors, int nVectors);
+bool mergeLoops(int *a, int nA, int *b, int nB, int edgeStart, int edgeEnd, vec3 *vectors, vec3 norm, int *merged, int *nMerged);
+int removeStraightCorners(int *loop, int n, vec3 *vectors, vec3 norm, int group, int *lead, int *vertexStart, int *vertexFaceList);
+float cornerTurn(vec3 a, vec3 b, vec3 c, vec3 norm);
+int facePolygon(faceTable *t, int i, int **polygon);
+bool polygonIsFace(faceTable *t, int i);
+bool clusterBackfacing(faceCluster *c, vec3 pos);
+void projectFace(int *polygon, int nPolygon, vec3 *points, view *eye, projectedFace *out);
+void drawFace(face f, projectedFace *p, SDL_Renderer *renderer, SDL_Surface **textures, spanBuffer *spans, indexedFrame *indexed, renderStats *stats);
+int drawWireframePolygon(vec2 *polygon, int nPoints, SDL_Renderer *renderer, indexedFrame *indexed);
+int fillTriangle(vec2 p1, vec2 p2, vec2 p3, SDL_Renderer *renderer, spanBuffer *spans, indexedFrame *indexed);
+int fillPolygon(vec2 *points, int n, SDL_Renderer *renderer, spanBuffer *spans, indexedFrame *indexed);
+void scanInit(polygonScan *s, vec2 *points, int n);
+bool scanRow(polygonScan *s, int *y, int *x1, int *x2);
+int drawSpan(int y, int x1, int x2, SDL_Renderer *renderer, spanBuffer *spans, indexedFrame *indexed);
+int drawRow(int y, int x1, int x2, SDL_Renderer *renderer, indexedFrame *indexed);
+void spanBufferInit(spanBuffer *b, int width, int height, arena *frameArena);
+int coverSpan(spanBuffer *b, int y, int x1, int x2);
+void occlusionInit(occlusionBuffer *o, int width, int height, arena *frameArena);
+void occlusionDrawPolygon(occlusionBuffer *o, vec3 *pointsR, int n);
+void occlusionBuildPyramid(occlusionBuffer *o);
+bool occluded(occlusionBuffer *o, vec3 *corners, int n, view *eye);
+void boxCorners(vec3 centre, float radius, vec3 *corners);
+bool indexedFrameInit(indexedFrame *f, SDL_Renderer *renderer, int width, int height, colour *colours, int nColours, int nTextures, bool overdraw);
+void indexedFrameFree(indexedFrame *f);
+Uint8 *textureRemap(indexedFrame *f, int i, SDL_Surface *texture);
+int nearestPaletteEntry(Uint32 *palette, int nPalette, Uint32 rgb);
+void resolveIndexedFrame(indexedFrame *f, int width, int height);
+void indexedWrite(indexedFrame *f, int y, int x1, int x2, Uint8 index);
+void resolveRowScalar(Uint8 *src, Uint32 *dst, Uint32 *palette, int n);
+#ifdef HAS_AVX_KERNELS
+AVX2_TARGET void resolveRowAVX2(Uint8 *src, Uint32 *dst, Uint32 *palette, int n);
+#endif
+int drawIndexedLine(indexedFrame *f, int x1, int y1, int x2, int y2);
 void swapVec2Ptr(vec2 **p1, vec2 **p2);
 int getClipCode(vec2 a);
-void drawClippedLine(vec2 a, vec2 b, SDL_Renderer *renderer);
-bool clipVelocity(camera *player, face triangle, vec3 *points);
-void buildClipVectors(int nVectors, int nFaces, vec3 *mapVectors, face *mapFaces, vec3 *clipVectors);
-void textureTriangle(vec2 p1, vec2 p2, vec2 p3, SDL_Renderer *renderer, float mA, float mB, float mC, float mD, vec2 origin, int furthest, SDL_Surface *texture, face f, float uz, float vz, float oz);
+int drawClippedLine(vec2 a, vec2 b, SDL_Renderer *renderer, indexedFrame *indexed);
+void buildCollisionTable(collisionTable *table, faceTable *mapFaces, vec3 *mapVectors, mesh *meshes, meshInstance *instances, int nInstances, arena *loadArena);
+void setCollisionFace(collisionTable *table, int i, vec3 p1, vec3 p2, vec3 p3, vec3 norm);
+bool collisionTest(collisionTable *table, int i, vec3 origin, vec3 vel, float radius, float *d);
+int findCollisionScalar(collisionTable *table, vec3 origin, vec3 vel, float radius, float *hitD);
+int findCollisionInList(collisionTable *table, int *list, int n, vec3 origin, vec3 vel, float radius, float *hitD);
+void fillContactCache(contactCache *cache, collisionTable *table, vec3 low, vec3 high);
+void rayBounds(vec3 origin, vec3 vel, float d, float radius, vec3 *low, vec3 *high);
+int findContact(contactCache *cache, collisionTable *table, vec3 origin, vec3 vel, float radius, float *hitD);
+#ifdef HAS_AVX_KERNELS
+AVX_TARGET int findCollisionAVX(collisionTable *table, vec3 origin, vec3 vel, float radius, float *hitD);
+#endif
+void buildIcosahedron(mesh *m, int nColours, arena *loadArena);
+void spawnEntities(entityStore *e, int n, int meshIndex, collisionTable *world, vec3 start, vec3 *mapVectors, int nVectors, arena *loadArena);
+float randomUnit(Uint32 *seed);
+void updateEntities(entityStore *e, collisionTable *world, arena *frameArena);
+int buildEntityInstances(entityStore *e, mesh *meshes, meshInstance *instances);
+int stepPlayer(camera *player, tickInput input, collisionTable *collision, contactCache *contacts);
+void turnPlayer(camera *player, int xrel, int yrel);
+void printLatency(int *counts);
+int latencyPercentile(int *counts, int n, float fraction);
+void simulationInit(simulation *sim, camera player, collisionTable *collision, entityStore *entities, mesh *meshes, meshInstance *mapInstances, int nMapInstances, FILE *replayFile, FILE *recordFile, arena *loadArena);
+bool nextTickInput(simulation *sim, tickInput *input);
+void simulateTick(simulation *sim, tickInput input);
+void writeSnapshot(simulation *sim, frameSnapshot *snapshot);
+int simulationThread(void *data);
+int defaultJobThreads(int nOtherThreads);
+bool jobPoolInit(jobPool *pool, int nThreads);
+void jobPoolFree(jobPool *pool);
+int jobWorkerThread(void *data);
+void parallelFor(jobPool *pool, int n, int grain, jobFunction function, void *data);
+void runJobs(jobPool *pool, int thread);
+int takeChunk(jobRange *r);
+bool stealChunks(jobRange *from, jobRange *to);
+void tripleBufferPublish(tripleBuffer *b);
+bool tripleBufferTake(tripleBuffer *b);
+bool arenaInit(arena *a, size_t size);
+void *arenaAlloc(arena *a, size_t size);
+void arenaReset(arena *a);
+void arenaFree(arena *a);
+bool writeReplayHeader(FILE *file, camera player);
+bool readReplayHeader(FILE *file, camera *player);
+bool writeTickInput(FILE *file, tickInput input);
+bool readTickInput(FILE *file, tickInput *input);
+bool frameCaptureInit(frameCapture *c, FILE *file, int width, int height, bool indexed);
+void captureFrame(frameCapture *c, int frame, bool reused, SDL_Renderer *renderer, SDL_Texture *renderTarget, indexedFrame *indexed);
+void frameCaptureFinish(frameCapture *c);
+int captureThread(void *data);
+bool writeCaptureFrame(FILE *file, captureSlot *slot, Uint8 *packed);
+int packRuns(Uint8 *src, int n, Uint8 *dst);
+void buildClipVectors(int nVectors, vec3 *mapVectors, faceTable *mapFaces, vec3 *clipVectors, arena *loadArena);
+int textureTriangle(vec2 p1, vec2 p2, vec2 p3, vec2 uv1, vec2 uv2, vec2 uv3, SDL_Renderer *renderer, SDL_Surface *texture, int textureIndex, spanBuffer *spans, indexedFrame *indexed);
+int texelFormat(SDL_Surface *texture);
+void texturedRowPalettedRenderer(textureRaster *t, int y, int x1, int x2);
+void texturedRowPalettedIndexed(textureRaster *t, int y, int x1, int x2);
+void texturedRowRGB24Renderer(textureRaster *t, int y, int x1, int x2);
+void texturedRowRGB32Renderer(textureRaster *t, int y, int x1, int x2);
+void drawRun(textureRaster *t, int y, int x2);
 
 int main(int argc, char **argv)
 {
     SDL_Window *window = NULL;
     SDL_Renderer *renderer = NULL;
 
+    //-generate <sphere|rooms|soup> <faces> <file> writes a test map, -bench [max faces] times the rasterizer, sorting, collision and loading on generated maps
+    //neither of them opens a window
+    if(argc >= 5 && strcmp(argv[1], "-generate") == 0)
+    {
+        generatedMap generated;
+        bool written = generateMap(&generated, argv[2], atoi(argv[3])) && writeGeneratedMap(&generated, argv[4]);
+        if(written)
+            printf("wrote %s: %d vectors, %d faces\n", argv[4], generated.nVectors, generated.nFaces);
+        freeGeneratedMap(&generated);
+        return written ? 0 : 1;
+    }
+    if(argc >= 2 && strcmp(argv[1], "-bench") == 0)
+        return runBenchmarks(argc >= 3 ? atoi(argv[2]) : BENCH_MAX_FACES);
+    if(argc >= 3 && strcmp(argv[1], "-regress") == 0) //-regress <cases> [tolerance] [-update], see runRegression
+    {
+        int tolerance = REGRESS_TOLERANCE;
+        bool update = false;
+        int i;
+        for(i=3;i < argc;i++)
+        {
+            if(strcmp(argv[i], "-update") == 0)
+                update = true;
+            else
+                tolerance = atoi(argv[i]);
+        }
+        return runRegression(argv[2], tolerance, update);
+    }
+
+    //-record <file> writes every tick of input to file, -replay <file> plays one back instead of reading the mouse and keyboard
+    //-capture <file> writes every frame drawn to file, see writeCaptureFrame
+    FILE *recordFile = NULL;
+    FILE *replayFile = NULL;
+    FILE *captureFile = NULL;
+    int arg;
+    for(arg=1;arg < argc - 1;arg++)
+    {
+        if(strcmp(argv[arg], "-record") == 0)
+            recordFile = fopen(argv[++arg], "wb");
+        else if(strcmp(argv[arg], "-capture") == 0)
+        {
+            captureFile = fopen(argv[++arg], "wb");
+            if(!captureFile)
+                printf("could not open capture file %s\n", argv[arg]);
+        }
+        else if(strcmp(argv[arg], "-replay") == 0)
+        {
+            replayFile = fopen(argv[++arg], "rb");
+            if(!replayFile)
+                printf("could not open replay %s\n", argv[arg]);
+        }
+    }
+
     if(SDL_Init(SDL_INIT_VIDEO) != 0)
         return 1;
 
-    loadConstants(&WIDTH, &HEIGHT, &SENSITIVITY, MAP_FILE, &FRUSTUM_WIDTH, &FRUSTUM_NEAR_LENGTH, &DRAW_EDGES, SETTINGS_FILE);
+    loadConstants(&WINDOW_WIDTH, &WINDOW_HEIGHT, &SENSITIVITY, MAP_FILE, &FRUSTUM_WIDTH, &FRUSTUM_NEAR_LENGTH, &DRAW_EDGES, SETTINGS_FILE);
+    MIN_RENDER_SCALE = clamp(MIN_RENDER_SCALE, 0.1, 1.0);
+    MAX_RENDER_SCALE = clamp(MAX_RENDER_SCALE, MIN_RENDER_SCALE, 1.0);
 
-    window = SDL_CreateWindow("Dank meme", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, WIDTH, HEIGHT, SDL_WINDOW_SHOWN);
-    renderer = SDL_CreateRenderer(window,1, SDL_RENDERER_ACCELERATED);
+    window = SDL_CreateWindow("Dank meme", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, WINDOW_WIDTH, WINDOW_HEIGHT, SDL_WINDOW_SHOWN);
+    renderer = SDL_CreateRenderer(window,1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_TARGETTEXTURE);
 
     SDL_CaptureMouse(true);
     SDL_SetRelativeMouseMode(true);
 
-    //set up map
-    camera player;
-    int mapVectorsNum = 0;
-    int mapFacesNum = 0;
-    int mapColoursNum = 0;
-    int mapTexturesNum = 0;
-    vec3 *mapVectors = NULL;
-    face *mapFaces = NULL;
-    colour *mapColours = NULL;
-    SDL_Surface **mapTextures = NULL;
-    loadMap(&mapVectorsNum, &mapFacesNum, &mapColoursNum, &mapVectors, &mapFaces, &mapColours, MAP_FILE, &player, &mapTextures, &mapTexturesNum);
-    bool *clippedFaces = malloc(mapFacesNum * sizeof(bool));
-    vec3 *mapClipVectors = malloc(mapVectorsNum * sizeof(vec3));
-    buildClipVectors(mapVectorsNum, mapFacesNum, mapVectors, mapFaces, mapClipVectors);
-
-    int lastTime;
+    //the map is read and built on other threads, the window shows a loading bar until it can be drawn
+    mapLoader loader;
+    startMapLoad(&loader, MAP_FILE);
+    arena frameArena; //per frame scratch, data built from the map lives in loader.loadArena
+    arenaInit(&frameArena, FRAME_ARENA_SIZE);
+    jobPool jobThreads; //drawFilledFaces splits its work over these threads, NULL does it all on this one
+    jobPool *jobs = jobPoolInit(&jobThreads, defaultJobThreads(1 + PIPELINED + (captureFile != NULL))) ? &jobThreads : NULL; //the loader, the simulation and the capture writer have their own
+    int i;
+
+    Uint32 lastTime = 0;
     SDL_RendererInfo info;
     SDL_GetRendererInfo(renderer, &info);
     printf("%s\n", info.name);
 
+    //faces are drawn into a texture at the internal resolution, which is then stretched over the whole window
+    //the texture is made at the largest allowed size, and only the top left WIDTH x HEIGHT part of it is used
+    SDL_Texture *renderTarget = NULL;
+    if(info.flags & SDL_RENDERER_TARGETTEXTURE)
+    {
+        SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "linear");
+        renderTarget = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGB888, SDL_TEXTUREACCESS_TARGET, WINDOW_WIDTH * MAX_RENDER_SCALE, WINDOW_HEIGHT * MAX_RENDER_SCALE);
+    }
+    if(!renderTarget) //no render to texture support, so draw straight to the window at full resolution
+        DYNAMIC_RESOLUTION = false;
+    float renderScale = renderTarget ? MAX_RENDER_SCALE : 1.0;
+    float rasterHistory[RESOLUTION_HISTORY];
+    int nRasterHistory = 0;
+    setRenderScale(renderScale);
+
     bool quit = false;
     SDL_Event e;
+    while(!quit && SDL_AtomicGet(&loader.stage) < LOAD_READY)
+    {
+        while(SDL_PollEvent(&e))
+            if(e.type == SDL_QUIT || (e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_ESCAPE))
+                quit = true;
+        SDL_SetRenderDrawColor(renderer, 0,0,0, SDL_ALPHA_OPAQUE);
+        SDL_RenderClear(renderer);
+        drawLoadingBar(renderer, WINDOW_HEIGHT/2, loadProgress(&loader));
+        SDL_RenderPresent(renderer);
+        SDL_Delay(16);
+    }
+    if(quit) //closed while loading, the loader still has to finish before anything can be freed
+        finishMapLoad(&loader);
+    else
+        printf("map ready after %d ms, %d faces drawn as %d polygons\n", SDL_GetTicks() - loader.startTime, loader.faces.n, loader.faces.nPolygons);
+
+    camera player = loader.player;
+    int mapTexturesNum = loader.nTextures;
+    int mapInstancesNum = loader.nInstances;
+    vec3 *mapVectors = loader.vectors;
+    faceTable *mapFaces = &loader.faces;
+    colour *mapColours = loader.colours;
+    meshInstance *mapInstances = loader.instances;
+    collisionTable *collision = &loader.collision;
+
+    indexedFrame indexedBuffer;
+    indexedFrame *indexed = NULL; //frames are drawn into this instead of renderTarget when it isn't NULL
+    if((INDEXED_FRAMEBUFFER || OVERDRAW_VIEW) && !quit) //WIDTH and HEIGHT are still at the largest render scale here
+    {
+        if(indexedFrameInit(&indexedBuffer, renderer, WIDTH, HEIGHT, mapColours, loader.nColours, mapTexturesNum, OVERDRAW_VIEW))
+            indexed = &indexedBuffer;
+        else
+            printf("could not make the indexed framebuffer, drawing in colour instead\n");
+    }
+    mesh *meshes = loader.allMeshes;
+    entityStore *entities = &loader.entities;
+
+    if(replayFile && !readReplayHeader(replayFile, &player))
+    {
+        printf("bad replay file\n");
+        fclose(replayFile);
+        replayFile = NULL;
+    }
+    if(recordFile)
+        writeReplayHeader(recordFile, player);
+
+    FILE *statsFile = NULL;
+    if(STATS_FILE[0] && !quit)
+    {
+        statsFile = fopen(STATS_FILE, "w");
+        if(statsFile)
+            writeStatsHeader(statsFile);
+        else
+            printf("could not open stats file %s\n", STATS_FILE);
+    }
+    frameCapture capture;
+    frameCapture *capturing = NULL;
+    if(captureFile && !quit) //frames are captured the way they're drawn, indexed ones by swapping buffers and colour ones by reading the renderer back into the slot
+    { //slots are made at the largest render scale, same as the indexed frame
+        if(frameCaptureInit(&capture, captureFile, indexed ? indexed->width : WIDTH, indexed ? indexed->height : HEIGHT, indexed != NULL))
+            capturing = &capture;
+        else
+            printf("could not start capturing frames\n");
+    }
+
+    renderStats stats;
+    int nFrames = 0;
+    Uint32 lastStatsTitle = 0;
+
+    //ticks are stepped by simulateTick and handed to drawing through sim.frames
+    //in pipelined mode that happens on the simulation thread while the last tick is being drawn, otherwise it's done here before each frame
+    simulation sim;
+    simulationInit(&sim, player, collision, entities, meshes, mapInstances, mapInstancesNum, replayFile, recordFile, &loader.loadArena);
+    SDL_Thread *simThread = NULL;
+    if(PIPELINED && !quit)
+        simThread = SDL_CreateThread(simulationThread, "simulation", &sim);
+
+    //what the frame in renderTarget was drawn from, if none of it changes the frame is presented again without drawing anything
+    camera lastView;
+    meshInstance *lastInstances = arenaAlloc(&loader.loadArena, (mapInstancesNum + entities->n) * sizeof(meshInstance));
+    int nLastInstances = -1; //-1 when renderTarget doesn't hold a frame that can be reused
+    int lastWidth = 0, lastHeight = 0, lastTexturesDone = 0;
+    bool windowDirty = true; //the window doesn't show the last frame drawn, so a reused frame still has to be copied and presented
+
     int arrows = 0; //up: 1, left: 2, down: 4, right: 8
     int wasd = 0; //w: 1, a: 2, s: 4, d: 8, space: 16
+    int nReplayFrames = 0, nReusedFrames = 0;
+    float replayFrameTotal = 0, replayFrameMax = 0;
+
+    //mouse movement latched just before a frame was drawn, it's already in the view so it's added to the next tick's input
+    int latchedX = 0, latchedY = 0;
+    SDL_Event latched[LATCH_EVENTS];
+    //when each mouse event not yet shown arrived and which frame of input it went in, counted into latencyCounts by how many ms before the present that first drew it
+    //pipelined ticks take their input whenever the simulation thread gets to them, so an event can wait a few presents before a tick has it
+    Uint32 inputTimes[LATENCY_EVENTS];
+    int inputFrames[LATENCY_EVENTS];
+    int nInputTimes = 0, inputsSent = 0;
+    int latencyCounts[LATENCY_BUCKETS];
+    memset(latencyCounts, 0, sizeof(latencyCounts));
     while(!quit)
     {
+        if(!replayFile && nFrames > 0) //the wait for the next frame goes before input is read rather than after the present, so the input drawn is as new as it can be
+            SDL_Delay(max(0, FRAME_TIME - (int)(SDL_GetTicks() - lastTime)));
         lastTime = SDL_GetTicks();
+        Uint64 frameStart = SDL_GetPerformanceCounter();
+        int xrel = latchedX, yrel = latchedY;
+        latchedX = latchedY = 0;
         while(SDL_PollEvent(&e))
         {
             if(e.type == SDL_QUIT)
@@ -240,773 +944,4492 @@ int main(int argc, char **argv)
             }
             else if(e.type == SDL_MOUSEMOTION)
             {
-                player.yaw -= e.motion.xrel*0.0004*SENSITIVITY; //change player's yaw and pitch angles based on the change in mouse position
-                player.pitch = clamp(player.pitch + e.motion.yrel*0.0004*SENSITIVITY, -M_PI/2, M_PI/2); //keep pitch within -2*pi and 2*pi
+                xrel += e.motion.xrel;
+                yrel += e.motion.yrel;
+                if(nInputTimes < LATENCY_EVENTS)
+                {
+                    inputTimes[nInputTimes] = e.motion.timestamp;
+                    inputFrames[nInputTimes++] = inputsSent + 1; //handed over below
+                }
+            }
+            else if(e.type == SDL_RENDER_TARGETS_RESET || e.type == SDL_RENDER_DEVICE_RESET) //the contents of renderTarget have been lost
+            {
+                nLastInstances = -1;
+                windowDirty = true;
             }
+            else if(e.type == SDL_WINDOWEVENT && (e.window.event == SDL_WINDOWEVENT_EXPOSED || e.window.event == SDL_WINDOWEVENT_SHOWN
+                || e.window.event == SDL_WINDOWEVENT_RESTORED || e.window.event == SDL_WINDOWEVENT_SIZE_CHANGED)) //something covered or resized the window
+                windowDirty = true;
         }
 
         //FRUSTUM_WIDTH += (float)((arrows & 1) - ((arrows & 4) >> 2)) * 0.01;
 
-        if(player.yaw > 2*M_PI) //keep yaw within the bounds of 0 and 2*pi
-            player.yaw -= 2*M_PI;
-        else if(player.yaw < 0)
-            player.yaw += 2*M_PI;
-
-        //player movement & linear interpolation
-        vec3 dv = {.x = (((wasd & 8) >> 3) - ((wasd & 2) >> 1)), .y = ((wasd & 1) - ((wasd & 4) >> 2)), .z = 0};
-        dv = mul(unit(dv),player.accel);
-
-        //player.vel.z = (((arrows & 4) >> 2) - (arrows & 1)) * player.speed;
-
-        //janky temporary jumping code
-        player.vel.z += 0.5; //gravity
-        if(player.pos.z >= -400 && false) //move player out of ground
+        inputsSent++;
+        if(simThread)
         {
-            player.pos.z = -400;
-            player.vel.z = 0;
+            if(!SDL_AtomicGet(&sim.running)) //end of the replay
+                break;
+            SDL_AtomicSet(&sim.keys, wasd | (arrows << 5));
+            SDL_AtomicAdd(&sim.xrel, xrel);
+            SDL_AtomicAdd(&sim.yrel, yrel);
+            SDL_AtomicSet(&sim.inputsSent, inputsSent);
         }
-
-        //if(player.pos.z == -400 && ((wasd & 16) == 16)) //if jump is pressed and at z == 0 then jump
-        if((wasd & 16) == 16)
-            player.vel.z = -5;
-
-        float zHold = player.vel.z; //zero z value of velocity vector so movement is only applied to x and y axes
-        player.vel.z = 0;
-
-        //FRUSTUM_WIDTH = clamp(length(player.vel) * 2 / player.speed, 0.01, 2);
-
-        player.vel = rotateZ(player.vel, -player.yaw);
-        if(dv.x == 0)//decelerate player based on released keys and camera yaw
+        else
         {
-            if(player.vel.x > 0)
-                player.vel.x = max(player.vel.x - player.decel, 0);
-            else
-                player.vel.x = min(player.vel.x + player.decel, 0);
+            tickInput input = {.keys = wasd | (arrows << 5), .xrel = clamp(xrel, -32768, 32767), .yrel = clamp(yrel, -32768, 32767)};
+            if(!nextTickInput(&sim, &input)) //end of the replay
+                break;
+            if(replayFile)
+                arrows = input.keys >> 5;
+            sim.inputsTaken = inputsSent;
+            simulateTick(&sim, input);
         }
 
-        if(dv.y == 0)
+        //draw the newest tick the simulation has finished, or the same one again if there isn't a newer one yet
+        if(!tripleBufferTake(&sim.frames) && simThread && replayFile) //replays draw every tick exactly once, so wait for the next
         {
-            if(player.vel.y > 0)
-                player.vel.y = max(player.vel.y - player.decel, 0);
-            else
-                player.vel.y = min(player.vel.y + player.decel, 0);
+            SDL_SemWaitTimeout(sim.frames.published, 10); //woken by the publish, the timeout keeps events coming if the simulation has stopped
+            continue;
         }
-
-        player.vel = add(player.vel, dv);
-        player.vel = rotateZ(player.vel, player.yaw);
-
-        if(length(player.vel) > player.speed) //limit speed
-            player.vel = mul(unit(player.vel),max(length(player.vel) - player.decel, player.speed));
-            //player.vel = mul(unit(player.vel), player.speed);
-        player.vel.z = zHold;
-
-        //int i;
-        //for(i=0;i < mapFacesNum;i++)
-        //    clipVelocity(&player, mapFaces[i], mapVectors);
-
-        int clipTimeStart = SDL_GetTicks();
-        int i;
-        bool velNotClipped = true;
-        for(i=0;i < mapFacesNum;i++)
-            clippedFaces[i] = true;
-        while(velNotClipped)
-        {
-            velNotClipped = false;
-            for(i=0;i < mapFacesNum;i++)
-                if(clippedFaces[i])
+        frameSnapshot *frame = &sim.frames.slots[sim.frames.front];
+        player = frame->player;
+        meshInstance *instances = frame->instances;
+        int nInstances = frame->nInstances;
+        arenaReset(&frameArena);
+
+        //late latch, only the view is turned here and the tick catches up next time round
+        //pipelined ticks are stepped whenever the simulation thread gets to them, so there's no point where the movement could be handed over like this
+        if(LATE_LATCH && !simThread && !replayFile)
+        {
+            int nLatched;
+            SDL_PumpEvents();
+            while((nLatched = SDL_PeepEvents(latched, LATCH_EVENTS, SDL_GETEVENT, SDL_MOUSEMOTION, SDL_MOUSEMOTION)) > 0)
+            {
+                for(i=0;i < nLatched;i++)
                 {
-                    vec3 clipPosHold = player.pos;
-                    if(player.vel.z > 0)
-                        player.pos.z += 400;
-                    else if(player.vel.z < 0)
-                        player.pos.z -= 50;
-                    player.pos = add(player.pos, mul(unit(dropZ(mapFaces[i].norm)), -100));
-                    if(clipVelocity(&player, mapFaces[i], mapVectors))
+                    latchedX += latched[i].motion.xrel;
+                    latchedY += latched[i].motion.yrel;
+                    if(nInputTimes < LATENCY_EVENTS)
                     {
-                        velNotClipped = true;
-                        //clippedFaces[i] = false;
-                        player.pos = clipPosHold;
-                        break;
+                        inputTimes[nInputTimes] = latched[i].motion.timestamp;
+                        inputFrames[nInputTimes++] = frame->inputsTaken; //already turned in this frame's view
                     }
-                    player.pos = clipPosHold;
                 }
-            if(SDL_GetTicks() - clipTimeStart > 50) //prevent infinite loop in case something breaks badly
-            {
-                printf("rekt\n");
-                velNotClipped = false;
             }
+            if(latchedX != 0 || latchedY != 0)
+                turnPlayer(&player, latchedX, latchedY);
+        }
 
+        //printf("x: %0.2f y: %0.2f z: %0.2f  speed: %0.2f\n", player.pos.x, player.pos.y, player.pos.z, length(player.vel));
+
+        int nTexturesDone = SDL_AtomicGet(&loader.nTexturesDone);
+        SDL_Surface **textures = loader.textures;
+        if(nTexturesDone < mapTexturesNum) //still streaming in, take a copy so the whole frame sees the same ones
+        {
+            textures = arenaAlloc(&frameArena, mapTexturesNum * sizeof(SDL_Surface *));
+            for(i=0;i < mapTexturesNum;i++)
+                textures[i] = SDL_AtomicGetPtr((void **)&loader.textures[i]);
         }
 
-        player.pos = add(player.pos, player.vel); //move player based on velocity
+        bool reuseFrame = REUSE_FRAMES && (renderTarget || indexed) && nInstances == nLastInstances && WIDTH == lastWidth && HEIGHT == lastHeight && nTexturesDone == lastTexturesDone
+            && sameView(player, lastView) && memcmp(instances, lastInstances, nInstances * sizeof(meshInstance)) == 0;
 
+        memset(&stats, 0, sizeof(renderStats));
+        stats.clipIterations = frame->clipIterations;
+        Uint64 rasterStart = SDL_GetPerformanceCounter();
+        if(!reuseFrame)
+        {
+            if(indexed)
+                memset(indexed->pixels, INDEXED_BLACK, indexed->width * HEIGHT);
+            else
+            {
+                if(renderTarget)
+                    SDL_SetRenderTarget(renderer, renderTarget);
+                SDL_SetRenderDrawColor(renderer, 0,0,0, SDL_ALPHA_OPAQUE);
+                SDL_RenderClear(renderer);
+            }
 
+            drawFilledFaces(mapFaces, player, mapVectors, renderer, mapColours, textures, meshes, instances, nInstances, &frameArena, indexed, jobs, &stats);
+            if(indexed)
+                resolveIndexedFrame(indexed, WIDTH, HEIGHT);
 
-        //printf("x: %0.2f y: %0.2f z: %0.2f  speed: %0.2f\n", player.pos.x, player.pos.y, player.pos.z, length(player.vel));
+            lastView = player;
+            memcpy(lastInstances, instances, nInstances * sizeof(meshInstance));
+            nLastInstances = nInstances;
+            lastWidth = WIDTH;
+            lastHeight = HEIGHT;
+            lastTexturesDone = nTexturesDone;
+        }
+        else
+            nReusedFrames++;
 
-        SDL_SetRenderDrawColor(renderer, 0,0,0, SDL_ALPHA_OPAQUE);
-        SDL_RenderClear(renderer);
+        if(capturing) //before the upscale, while renderTarget still holds just the frame
+            captureFrame(capturing, nFrames, reuseFrame, renderer, renderTarget, indexed);
 
-        drawFilledFaces(mapFaces, mapFacesNum, player, mapVectors, renderer, mapColours, mapTextures);
-        //drawFilledFaces(mapFaces, mapFacesNum, player, mapClipVectors, renderer, mapColours);
+        //the window already shows this frame, the loading bar moves while textures come in and the texture view is drawn over it every frame
+        bool skipPresent = reuseFrame && !windowDirty && nTexturesDone == mapTexturesNum && (arrows & 1) == 0;
+        if(skipPresent)
+        {
+            if(statsFile)
+                writeStats(statsFile, nFrames, 0, true, &stats);
+            nFrames++;
+            if(replayFile)
+            {
+                replayFrameTotal += (float)(SDL_GetPerformanceCounter() - frameStart) * 1000.0 / (float)SDL_GetPerformanceFrequency();
+                nReplayFrames++;
+            }
+            continue;
+        }
 
-        //draw crosshair
-        SDL_SetRenderDrawColor(renderer, CROSSHAIR_R, CROSSHAIR_G, CROSSHAIR_B, SDL_ALPHA_OPAQUE);
-        SDL_RenderDrawLine(renderer, WIDTH/2 + CROSSHAIR_SIZE, HEIGHT/2, WIDTH/2 - CROSSHAIR_SIZE, HEIGHT/2);
-        SDL_RenderDrawLine(renderer, WIDTH/2, HEIGHT/2 + CROSSHAIR_SIZE, WIDTH/2, HEIGHT/2 - CROSSHAIR_SIZE);
+        if(indexed) //upscale the internal resolution image to the window
+        {
+            SDL_Rect renderedArea = {0, 0, WIDTH, HEIGHT};
+            SDL_RenderCopy(renderer, indexed->texture, &renderedArea, NULL);
+        }
+        else if(renderTarget)
+        {
+            SDL_Rect renderedArea = {0, 0, WIDTH, HEIGHT};
+            SDL_SetRenderTarget(renderer, NULL);
+            SDL_RenderCopy(renderer, renderTarget, &renderedArea, NULL);
+        }
+        float rasterTime = (float)(SDL_GetPerformanceCounter() - rasterStart) * 1000.0 / (float)SDL_GetPerformanceFrequency();
+        if(statsFile)
+            writeStats(statsFile, nFrames, rasterTime, reuseFrame, &stats);
+        if(RENDER_STATS && !reuseFrame && SDL_GetTicks() - lastStatsTitle >= STATS_TITLE_INTERVAL)
+        {
+            showStats(window, &stats);
+            lastStatsTitle = SDL_GetTicks();
+        }
+        nFrames++;
 
+        //draw crosshair at window resolution so it stays sharp
+        SDL_SetRenderDrawColor(renderer, CROSSHAIR_R, CROSSHAIR_G, CROSSHAIR_B, SDL_ALPHA_OPAQUE);
+        SDL_RenderDrawLine(renderer, WINDOW_WIDTH/2 + CROSSHAIR_SIZE, WINDOW_HEIGHT/2, WINDOW_WIDTH/2 - CROSSHAIR_SIZE, WINDOW_HEIGHT/2);
+        SDL_RenderDrawLine(renderer, WINDOW_WIDTH/2, WINDOW_HEIGHT/2 + CROSSHAIR_SIZE, WINDOW_WIDTH/2, WINDOW_HEIGHT/2 - CROSSHAIR_SIZE);
+        if(nTexturesDone < mapTexturesNum)
+            drawLoadingBar(renderer, WINDOW_HEIGHT - LOADING_BAR_HEIGHT * 2, loadProgress(&loader));
 
-        if((arrows & 1) == 1)
+        if((arrows & 1) == 1 && mapTexturesNum > 0 && textures[0])
         {
             SDL_Rect rekt = {0,0,1920,1080};
-            SDL_BlitScaled(mapTextures[0],NULL,SDL_GetWindowSurface(window),&rekt);
+            SDL_BlitScaled(textures[0],NULL,SDL_GetWindowSurface(window),&rekt);
         }
 
 
         SDL_RenderPresent(renderer);
+        windowDirty = false;
+        Uint32 presentTime = SDL_GetTicks();
+        int nWaiting = 0;
+        for(i=0;i < nInputTimes;i++)
+        {
+            if(inputFrames[i] > frame->inputsTaken) //not in the tick that was drawn yet
+            {
+                inputTimes[nWaiting] = inputTimes[i];
+                inputFrames[nWaiting++] = inputFrames[i];
+            }
+            else if(!replayFile) //replayed input has no real event times
+            {
+                Uint32 latency = presentTime - inputTimes[i];
+                latencyCounts[latency < LATENCY_BUCKETS ? latency : LATENCY_BUCKETS - 1]++;
+            }
+        }
+        nInputTimes = nWaiting;
+
+        if(DYNAMIC_RESOLUTION && !reuseFrame) //a reused frame takes no time to draw, so it says nothing about the scale
+        {
+            renderScale = updateRenderScale(renderScale, rasterTime, rasterHistory, &nRasterHistory);
+            setRenderScale(renderScale);
+        }
 
-        SDL_Delay(max(0,16 - SDL_GetTicks() + lastTime)); //make sure the time interval is always the same
+        if(replayFile) //replays run as fast as possible so frame times can be compared between builds
+        {
+            float frameTime = (float)(SDL_GetPerformanceCounter() - frameStart) * 1000.0 / (float)SDL_GetPerformanceFrequency();
+            replayFrameTotal += frameTime;
+            replayFrameMax = max(replayFrameMax, frameTime);
+            nReplayFrames++;
+        }
         //printf("FPS: %d\n", (int)(1000.0f/(float)(SDL_GetTicks() - lastTime))); //print fps
     }
 
+    if(simThread)
+    {
+        SDL_AtomicSet(&sim.running, 0);
+        SDL_WaitThread(simThread, NULL);
+    }
+    arenaFree(&sim.tickArena);
+    if(sim.frames.published)
+        SDL_DestroySemaphore(sim.frames.published);
+    if(sim.frames.taken)
+        SDL_DestroySemaphore(sim.frames.taken);
+
+    if(replayFile)
+    {
+        if(nReplayFrames > 0)
+            printf("replay: %d frames (%d reused), average %0.3f ms, worst %0.3f ms\n", nReplayFrames, nReusedFrames, replayFrameTotal / nReplayFrames, replayFrameMax);
+        printf("replay end: x: %0.3f y: %0.3f z: %0.3f\n", sim.player.pos.x, sim.player.pos.y, sim.player.pos.z);
+        fclose(replayFile);
+    }
+    if(recordFile)
+        fclose(recordFile);
+    if(statsFile)
+        fclose(statsFile);
+    if(capturing)
+        frameCaptureFinish(capturing);
+    if(captureFile)
+        fclose(captureFile);
+    printLatency(latencyCounts);
+
+    if(indexed)
+        indexedFrameFree(indexed);
+    if(renderTarget)
+        SDL_DestroyTexture(renderTarget);
+
     if(renderer)
         SDL_DestroyRenderer(renderer);
 
     if(window)
         SDL_DestroyWindow(window);
 
-    int i;
-    for(i=0;i < mapTexturesNum;i++)
-        SDL_FreeSurface(mapTextures[i]);
-
-    free(mapVectors);
-    free(mapFaces);
-    free(mapColours);
-    free(clippedFaces);
-    free(mapClipVectors);
-    free(mapTextures);
+    freeMap(&loader);
+    jobPoolFree(&jobThreads);
+    arenaFree(&frameArena);
     SDL_DestroyWindow(window);
     SDL_Quit();
 
     return 0;
 }
 
-/*
-map file format:
-player.pos.x,player.pos.y,player.pos.z,player.vel.x,player.vel.y,player.vel.z,player.pitch,player.yaw,player.speed,player.accel,player.decel
-num_of_vertices,num_of_faces,num_of_colours
-vec0.x,vec0.y,vec0.z
-vec1.x,vec1.y,vec1.z
-vec2.x,vec2.y,vec2.z&(*player)
-...
-face0.p1,face0.p2,face0.p3,face0.texture,face0.norm.x,face0.norm.y,face0.norm.z,face0.type,face0.flags
-face1.p1,face1.p2,face1.p3,face1.texture,face1.norm.x,face1.norm.y,face1.norm.z,face1.type,face1.flags
-...
-*/
+void turnPlayer(camera *player, int xrel, int yrel) //change player's yaw and pitch angles based on the change in mouse position
+{
+    player->yaw -= xrel*0.0004*SENSITIVITY;
+    player->pitch = clamp(player->pitch + yrel*0.0004*SENSITIVITY, -M_PI/2, M_PI/2); //keep pitch within -2*pi and 2*pi
+
+    if(player->yaw > 2*M_PI) //keep yaw within the bounds of 0 and 2*pi
+        player->yaw -= 2*M_PI;
+    else if(player->yaw < 0)
+        player->yaw += 2*M_PI;
+}
 
 /*
-since calculating the surface normals for every face manually can be tedious, it is calculated by taking the cross product of the vectors p0-p1 and p0-p2
-the type is used to determine whether the face normal points towards the origin or away (0 towards, 1 away)
+runs one tick of the player's movement and collision from the given input
+nothing in here reads the clock or SDL events, so feeding the same inputs from the same starting camera always gives the same result
+returns how many times the collision loop went round
 */
-
-void loadMap(int *nVectors, int *nFaces, int *nColors, vec3 **vectors, face **faces, colour **colours, char *fileName, camera *player, SDL_Surface ***textures, int *nTextures)
+int stepPlayer(camera *player, tickInput input, collisionTable *collision, contactCache *contacts)
 {
-    FILE *mapFile = fopen(fileName, "r");
-    fscanf(mapFile,"%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f\n", &(*player).pos.x, &(*player).pos.y, &(*player).pos.z, &(*player).vel.x, &(*player).vel.y, &(*player).vel.z, &(*player).pitch, &(*player).yaw, &(*player).speed, &(*player).accel, &(*player).decel);
-    fscanf(mapFile,"%d,%d,%d,%d\n",nVectors,nFaces,nColors,nTextures);
-    *vectors = (vec3 *)malloc(*nVectors * sizeof(vec3));
-    *faces = (face *)malloc(*nFaces * sizeof(face));
-    *colours = (colour *)malloc(*nColors * sizeof(colour));
-    *textures = (SDL_Surface **)malloc(*nTextures * sizeof(SDL_Surface *));
+    turnPlayer(player, input.xrel, input.yrel);
 
-    int i;
-    for(i=0;i < *nVectors;i++)
-        fscanf(mapFile,"%f,%f,%f\n",&(*vectors)[i].x, &(*vectors)[i].y, &(*vectors)[i].z);
-    for(i=0;i < *nFaces;i++)
+    //player movement & linear interpolation
+    vec3 dv = {.x = (((input.keys & 8) >> 3) - ((input.keys & 2) >> 1)), .y = ((input.keys & 1) - ((input.keys & 4) >> 2)), .z = 0};
+    dv = mul(unit(dv),player->accel);
+
+    //player->vel.z = (((arrows & 4) >> 2) - (arrows & 1)) * player->speed;
+
+    //janky temporary jumping code
+    player->vel.z += 0.5; //gravity
+    if(player->pos.z >= -400 && false) //move player out of ground
     {
-        fscanf(mapFile,"%d,%d,%d,%d,%f,%f,%f,%d,%d,%f,%f,%f,%f,%f,%f\n", &(*faces)[i].p1, &(*faces)[i].p2, &(*faces)[i].p3, &(*faces)[i].texture, &(*faces)[i].norm.x, &(*faces)[i].norm.y, &(*faces)[i].norm.z, &(*faces)[i].type, &(*faces)[i].flags, &(*faces)[i].uv1.x, &(*faces)[i].uv1.y, &(*faces)[i].uv2.x, &(*faces)[i].uv2.y, &(*faces)[i].uv3.x, &(*faces)[i].uv3.y);
-        (*faces)[i].mid = mul(add((*vectors)[(*faces)[i].p1],add((*vectors)[(*faces)[i].p2],(*vectors)[(*faces)[i].p3])), 1.0/3.0);
-        if(GENERATE_FACE_NORMALS)
-        {
-            (*faces)[i].norm = unit(cross(sub((*vectors)[(*faces)[i].p2], (*vectors)[(*faces)[i].p1]), sub((*vectors)[(*faces)[i].p3], (*vectors)[(*faces)[i].p1])));
-            //(*faces)[i].norm = unit(mul((*faces)[i].norm, dot((*faces)[i].norm,(*faces)[i].mid) * ((*faces)[i].type * 2 - 1)));
-            if(((dot((*faces)[i].norm, (*faces)[i].mid) <= 0) == (*faces)[i].type) || (dot((*faces)[i].norm, (*faces)[i].mid) == 0 && (*faces)[i].norm.z > 0))
-                (*faces)[i].norm = mul((*faces)[i].norm, -1);
-        }
+        player->pos.z = -400;
+        player->vel.z = 0;
+    }
+
+    //if(player->pos.z == -400 && ((input.keys & 16) == 16)) //if jump is pressed and at z == 0 then jump
+    if((input.keys & 16) == 16)
+        player->vel.z = -5;
+
+    float zHold = player->vel.z; //zero z value of velocity vector so movement is only applied to x and y axes
+    player->vel.z = 0;
+
+    //FRUSTUM_WIDTH = clamp(length(player->vel) * 2 / player->speed, 0.01, 2);
 
+    player->vel = rotateZ(player->vel, -player->yaw);
+    if(dv.x == 0)//decelerate player based on released keys and camera yaw
+    {
+        if(player->vel.x > 0)
+            player->vel.x = max(player->vel.x - player->decel, 0);
+        else
+            player->vel.x = min(player->vel.x + player->decel, 0);
     }
-    for(i=0;i < *nColors;i++)
-        fscanf(mapFile,"%d,%d,%d\n", &(*colours)[i].r, &(*colours)[i].g, &(*colours)[i].b);
-    static char tempString[30];
-    for(i=0;i < *nTextures;i++)
+
+    if(dv.y == 0)
     {
-        fscanf(mapFile,"%[^\n]\n",tempString);
-        (*textures)[i] = SDL_LoadBMP(tempString);
+        if(player->vel.y > 0)
+            player->vel.y = max(player->vel.y - player->decel, 0);
+        else
+            player->vel.y = min(player->vel.y + player->decel, 0);
     }
 
+    player->vel = add(player->vel, dv);
+    player->vel = rotateZ(player->vel, player->yaw);
 
-    fclose(mapFile);
-}
+    if(length(player->vel) > player->speed) //limit speed
+        player->vel = mul(unit(player->vel),max(length(player->vel) - player->decel, player->speed));
+        //player->vel = mul(unit(player->vel), player->speed);
+    player->vel.z = zHold;
 
+    //keep clipping the velocity against the first face it hits until it doesn't hit anything
+    //the ray starts above or below the player depending on which way they're moving vertically, and is pushed out from each face by the player's radius
+    vec3 origin = player->pos;
+    int hits[CONTACT_RECENT], nHits = 0;
+    int iterations;
+    for(iterations=0;iterations < MAX_CLIP_ITERATIONS;iterations++)
+    {
+        origin.z = player->pos.z + (player->vel.z > 0 ? 400 : (player->vel.z < 0 ? -50 : 0));
+        float d;
+        int hit = findContact(contacts, collision, origin, player->vel, PLAYER_RADIUS, &d);
+        if(hit < 0)
+            break;
 
-#define OFFSET 100.0 //temporary until the offset value is added to the face struct
+        int i;
+        for(i=0;i < nHits && hits[i] != hit;i++);
+        if(i == nHits && nHits < CONTACT_RECENT)
+            hits[nHits++] = hit;
 
-void buildClipVectors(int nVectors, int nFaces, vec3 *mapVectors, face *mapFaces, vec3 *clipVectors) //sorry, clip machine broke
+        vec3 norm = {collision->nx[hit], collision->ny[hit], collision->nz[hit]};
+        player->vel = sub(player->vel, mul(norm, dot(norm, mul(player->vel, 1.0 - d)) - COLLISION_EPSILON));
+    }
+    if(iterations == MAX_CLIP_ITERATIONS)
+        printf("rekt\n");
+    memcpy(contacts->recent, hits, nHits * sizeof(int));
+    contacts->nRecent = nHits;
+
+    player->pos = add(player->pos, player->vel); //move player based on velocity
+    return iterations;
+}
+
+void simulationInit(simulation *sim, camera player, collisionTable *collision, entityStore *entities, mesh *meshes, meshInstance *mapInstances, int nMapInstances, FILE *replayFile, FILE *recordFile, arena *loadArena)
 {
+    memset(sim, 0, sizeof(simulation));
+    sim->player = player;
+    sim->collision = collision;
+    sim->entities = entities;
+    sim->meshes = meshes;
+    sim->mapInstances = mapInstances;
+    sim->nMapInstances = nMapInstances;
+    sim->replayFile = replayFile;
+    sim->recordFile = recordFile;
+    arenaInit(&sim->tickArena, FRAME_ARENA_SIZE);
+    sim->contacts.faces = arenaAlloc(loadArena, CONTACT_CACHE_SIZE * sizeof(int));
+    sim->contacts.reach = CONTACT_REACH;
+    SDL_AtomicSet(&sim->running, 1);
+
     int i;
-    for(i=0;i < nVectors;i++)
+    for(i=0;i < 3;i++) //every slot starts out holding the starting state
     {
-        int j;
-        int nLinkedFaces = 0;
-        for(j=0;j < nFaces;j++)
-            if(mapFaces[j].p1 == i || mapFaces[j].p2 == i || mapFaces[j].p3 == i)
-                nLinkedFaces++;
-
-        if(nLinkedFaces == 0) //gg
-            continue;
-
-        face *linkedFaces = malloc(sizeof(face) * nLinkedFaces);
+        sim->frames.slots[i].instances = arenaAlloc(loadArena, (nMapInstances + entities->n) * sizeof(meshInstance));
+        writeSnapshot(sim, &sim->frames.slots[i]);
+    }
+    sim->frames.front = 0;
+    SDL_AtomicSet(&sim->frames.middle, 1);
+    sim->frames.back = 2;
+    sim->frames.published = SDL_CreateSemaphore(0);
+    sim->frames.taken = SDL_CreateSemaphore(0);
+}
 
-        int k = 0;
-        for(j=0;j < nFaces && k < nLinkedFaces;j++)
-            if(mapFaces[j].p1 == i || mapFaces[j].p2 == i || mapFaces[j].p3 == i)
-                linkedFaces[k++] = mapFaces[j];
+bool nextTickInput(simulation *sim, tickInput *input) //swaps in the replay's input for this tick or records it, false once the replay has run out
+{
+    if(sim->replayFile)
+        return readTickInput(sim->replayFile, input);
+    if(sim->recordFile)
+        writeTickInput(sim->recordFile, *input);
+    return true;
+}
 
-        int nFinalFaces = nLinkedFaces;
+void simulateTick(simulation *sim, tickInput input)
+{
+    sim->clipIterations = stepPlayer(&sim->player, input, sim->collision, &sim->contacts);
+    arenaReset(&sim->tickArena);
+    updateEntities(sim->entities, sim->collision, &sim->tickArena);
+    writeSnapshot(sim, &sim->frames.slots[sim->frames.back]);
+    tripleBufferPublish(&sim->frames);
+}
 
-        for(j=0;j < nLinkedFaces;j++) //type is not being used here so use it as a null flag
-            for(k=j+1; linkedFaces[j].type != -1 && k < nLinkedFaces;k++)
-                if(linkedFaces[k].type != -1 && fabs(linkedFaces[k].norm.x) == fabs(linkedFaces[j].norm.x) && fabs(linkedFaces[k].norm.y) == fabs(linkedFaces[j].norm.y) && fabs(linkedFaces[k].norm.z) == fabs(linkedFaces[j].norm.z))
-                {
-                    //printf("wew");
-                    linkedFaces[k].type = -1;
-                    nFinalFaces--;
-                }
+void writeSnapshot(simulation *sim, frameSnapshot *snapshot)
+{
+    snapshot->player = sim->player;
+    snapshot->clipIterations = sim->clipIterations;
+    snapshot->inputsTaken = sim->inputsTaken;
+    memcpy(snapshot->instances, sim->mapInstances, sim->nMapInstances * sizeof(meshInstance)); //the map's instances never move, entities go after them
+    snapshot->nInstances = sim->nMapInstances + buildEntityInstances(sim->entities, sim->meshes, snapshot->instances + sim->nMapInstances);
+}
 
-        int faceNum;
-        if(nFinalFaces == 1)
+int simulationThread(void *data) //steps a tick every 16 ms until stopped, replays go as fast as the renderer takes their ticks
+{
+    simulation *sim = data;
+    while(SDL_AtomicGet(&sim->running))
+    {
+        while(sim->replayFile && (SDL_AtomicGet(&sim->frames.middle) & TRIPLE_BUFFER_FRESH) && SDL_AtomicGet(&sim->running)) //last tick hasn't been taken yet
+            SDL_SemWaitTimeout(sim->frames.taken, 10); //the timeout only matters when stopping, every take posts
+        Uint32 tickStart = SDL_GetTicks();
+        sim->inputsTaken = SDL_AtomicGet(&sim->inputsSent); //before the movement is taken, so everything counted here is in it
+        tickInput input = {.keys = SDL_AtomicGet(&sim->keys), .xrel = clamp(SDL_AtomicSet(&sim->xrel, 0), -32768, 32767), .yrel = clamp(SDL_AtomicSet(&sim->yrel, 0), -32768, 32767)};
+        if(!nextTickInput(sim, &input))
         {
-            for(faceNum=0;linkedFaces[faceNum].type == -1 && faceNum < nLinkedFaces;faceNum++);
-            clipVectors[i] = add(mapVectors[i], mul(linkedFaces[faceNum].norm, OFFSET));
+            SDL_AtomicSet(&sim->running, 0);
+            break;
         }
-        else
-        {
-            vec3 norm1, norm2, norm3;
-            vec3 origin1, origin2, origin3;
-            float d1, d2, d3;
-
-            for(faceNum=0;linkedFaces[faceNum].type == -1 && faceNum < nLinkedFaces;faceNum++);
-            norm1 = linkedFaces[faceNum].norm;
-            if(i == 15)
-            {
-                int rip;
-                for(rip=0;rip < nFaces;rip++)
-                    if(mapFaces[rip].p1 == linkedFaces[faceNum].p1 && mapFaces[rip].p2 == linkedFaces[faceNum].p2 && mapFaces[rip].p3 == linkedFaces[faceNum].p3)
-                    {
-                        mapFaces[rip].texture = 4;
-                        break;
-                    }
-            }
+        simulateTick(sim, input);
+        if(!sim->replayFile)
+            SDL_Delay(max(0, 16 - SDL_GetTicks() + tickStart));
+    }
+    return 0;
+}
 
-            //origin1 = add(mapVectors[i], mul(norm1, OFFSET));
-            origin1 = add(mapVectors[linkedFaces[faceNum].p1], mul(norm1, OFFSET));
-            linkedFaces[faceNum].type = -1;
+int defaultJobThreads(int nOtherThreads) //JOB_THREADS if it's set, otherwise a thread for every core not taken by the nOtherThreads started alongside the main one
+{
+    return JOB_THREADS > 0 ? JOB_THREADS : max(SDL_GetCPUCount() - nOtherThreads, 1);
+}
 
-            for(faceNum=0;linkedFaces[faceNum].type == -1 && faceNum < nLinkedFaces;faceNum++);
-            norm2 = linkedFaces[faceNum].norm;
-            if(i == 15)
-            {
-                int rip;
-                for(rip=0;rip < nFaces;rip++)
-                    if(mapFaces[rip].p1 == linkedFaces[faceNum].p1 && mapFaces[rip].p2 == linkedFaces[faceNum].p2 && mapFaces[rip].p3 == linkedFaces[faceNum].p3)
-                    {
-                        mapFaces[rip].texture = 4;
-                        break;
-                    }
+bool jobPoolInit(jobPool *pool, int nThreads) //starts nThreads - 1 workers, fewer if some couldn't be made, false if the semaphores couldn't be
+{
+    memset(pool, 0, sizeof(jobPool));
+    pool->nThreads = 1;
+    pool->start = SDL_CreateSemaphore(0);
+    pool->done = SDL_CreateSemaphore(0);
+    if(!pool->start || !pool->done)
+        return false;
+    while(pool->nThreads < nThreads && pool->nThreads < MAX_JOB_THREADS && (pool->threads[pool->nThreads] = SDL_CreateThread(jobWorkerThread, "jobs", pool)))
+        pool->nThreads++;
+    return true;
+}
+
+void jobPoolFree(jobPool *pool)
+{
+    int i;
+    pool->quit = true;
+    for(i=1;i < pool->nThreads;i++)
+        SDL_SemPost(pool->start);
+    for(i=1;i < pool->nThreads;i++)
+        SDL_WaitThread(pool->threads[i], NULL);
+    if(pool->start)
+        SDL_DestroySemaphore(pool->start);
+    if(pool->done)
+        SDL_DestroySemaphore(pool->done);
+}
+
+int jobWorkerThread(void *data)
+{
+    jobPool *pool = data;
+    int thread = SDL_AtomicAdd(&pool->nextThread, 1) + 1;
+    while(true)
+    {
+        SDL_SemWait(pool->start);
+        if(pool->quit)
+            break;
+        runJobs(pool, thread);
+        SDL_SemPost(pool->done);
+    }
+    return 0;
+}
+
+/*
+calls function on every item from 0 to n - 1, split into chunks of at least grain items over every thread in the pool, and returns once they're all done
+each thread starts with an even share of the chunks, and steals from the others once it runs out, so a slow chunk doesn't hold the rest up
+*/
+void parallelFor(jobPool *pool, int n, int grain, jobFunction function, void *data)
+{
+    if(!pool || pool->nThreads <= 1 || n <= grain) //not worth waking anything up for
+    {
+        if(n > 0)
+            function(data, 0, n, 0);
+        return;
+    }
+
+    pool->function = function;
+    pool->data = data;
+    pool->n = n;
+    pool->chunk = grain;
+    if((n + grain - 1) / grain > JOB_MAX_CHUNKS)
+        pool->chunk = (n + JOB_MAX_CHUNKS - 1) / JOB_MAX_CHUNKS;
+    int nChunks = (n + pool->chunk - 1) / pool->chunk;
+    int i;
+    for(i=0;i < pool->nThreads;i++)
+        SDL_AtomicSet(&pool->ranges[i].range, (nChunks * (i + 1) / pool->nThreads) << 16 | nChunks * i / pool->nThreads);
+
+    for(i=1;i < pool->nThreads;i++)
+        SDL_SemPost(pool->start);
+    runJobs(pool, 0);
+    for(i=1;i < pool->nThreads;i++)
+        SDL_SemWait(pool->done);
+}
+
+void runJobs(jobPool *pool, int thread) //does this thread's chunks, then steals from the others until there's nothing left to steal
+{
+    int chunk, i;
+    while(true)
+    {
+        while((chunk = takeChunk(&pool->ranges[thread])) >= 0)
+        {
+            int last = (chunk + 1) * pool->chunk;
+            pool->function(pool->data, chunk * pool->chunk, last < pool->n ? last : pool->n, thread);
+        }
+        for(i=1;i < pool->nThreads && !stealChunks(&pool->ranges[(thread + i) % pool->nThreads], &pool->ranges[thread]);i++);
+        if(i == pool->nThreads)
+            return;
+    }
+}
+
+int takeChunk(jobRange *r) //the next chunk from the front of the range, -1 if it's empty
+{
+    while(true)
+    {
+        int range = SDL_AtomicGet(&r->range);
+        int front = range & 0xffff, end = range >> 16;
+        if(front >= end)
+            return -1;
+        if(SDL_AtomicCAS(&r->range, range, end << 16 | (front + 1)))
+            return front;
+    }
+}
+
+bool stealChunks(jobRange *from, jobRange *to) //moves the back half of from's chunks to to, which is empty because only its owner steals into it
+{
+    while(true)
+    {
+        int range = SDL_AtomicGet(&from->range);
+        int front = range & 0xffff, end = range >> 16;
+        if(front >= end)
+            return false;
+        int middle = end - (end - front + 1) / 2;
+        if(SDL_AtomicCAS(&from->range, range, middle << 16 | front))
+        {
+            SDL_AtomicSet(&to->range, end << 16 | middle);
+            return true;
+        }
+    }
+}
+
+void tripleBufferPublish(tripleBuffer *b) //hands the back slot over and takes whichever slot was in the middle to write the next one
+{
+    b->back = SDL_AtomicSet(&b->middle, b->back | TRIPLE_BUFFER_FRESH) & ~TRIPLE_BUFFER_FRESH;
+    if(b->published && SDL_SemValue(b->published) == 0) //outside replays nobody waits, so don't let the count pile up
+        SDL_SemPost(b->published);
+}
+
+bool tripleBufferTake(tripleBuffer *b) //swaps the front slot for the middle one if it's newer, false if there was nothing new
+{
+    if((SDL_AtomicGet(&b->middle) & TRIPLE_BUFFER_FRESH) == 0)
+        return false;
+    b->front = SDL_AtomicSet(&b->middle, b->front) & ~TRIPLE_BUFFER_FRESH;
+    if(b->taken && SDL_SemValue(b->taken) == 0)
+        SDL_SemPost(b->taken);
+    return true;
+}
+
+bool arenaInit(arena *a, size_t size)
+{
+    a->block = malloc(size + ARENA_ALIGN);
+    a->memory = a->block ? (char *)(((size_t)a->block + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1)) : NULL;
+    a->size = a->block ? size : 0;
+    a->used = a->wanted = 0;
+    a->spilled = NULL;
+    return a->block != NULL;
+}
+
+void *arenaAlloc(arena *a, size_t size) //memory is aligned to ARENA_ALIGN and only valid until the next reset
+{
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    a->wanted += size;
+    if(a->used + size <= a->size)
+    {
+        void *r = a->memory + a->used;
+        a->used += size;
+        return r;
+    }
+
+    //out of room, so fall back to the heap until the next reset makes the arena big enough
+    arenaSpill *spill = malloc(ARENA_ALIGN * 2 + size);
+    if(!spill)
+        return NULL;
+    spill->next = a->spilled;
+    a->spilled = spill;
+    return (void *)(((size_t)spill + sizeof(arenaSpill) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1));
+}
+
+void arenaReset(arena *a)
+{
+    while(a->spilled)
+    {
+        arenaSpill *next = a->spilled->next;
+        free(a->spilled);
+        a->spilled = next;
+    }
+    if(a->wanted > a->size) //last use didn't fit, grow so it won't spill again
+    {
+        size_t size = a->wanted + a->wanted / 2;
+        free(a->block);
+        arenaInit(a, size);
+    }
+    a->used = 0;
+    a->wanted = 0;
+}
+
+void arenaFree(arena *a)
+{
+    a->wanted = 0;
+    arenaReset(a);
+    free(a->block);
+    a->block = a->memory = NULL;
+    a->size = 0;
+}
+
+void buildCollisionTable(collisionTable *table, faceTable *mapFaces, vec3 *mapVectors, mesh *meshes, meshInstance *instances, int nInstances, arena *loadArena) //map faces first, then the faces of every instance moved into world space
+{
+    int i, j, k;
+    int nFaces = mapFaces->n;
+    table->n = nFaces;
+    for(i=0;i < nInstances;i++)
+        table->n += meshes[instances[i].mesh].nFaces;
+    table->nPadded = (table->n + 7) & ~7;
+    float **fields[] = {&table->nx, &table->ny, &table->nz, &table->planeD, &table->hx, &table->hy, &table->hn,
+                        &table->px, &table->py, &table->pz, &table->t2x, &table->t2y, &table->t2z, &table->t3x, &table->t3y, &table->t3z,
+                        &table->d22, &table->d23, &table->d33, &table->invBot,
+                        &table->minX, &table->maxX, &table->minY, &table->maxY, &table->minZ, &table->maxZ};
+    for(i=0;i < sizeof(fields) / sizeof(fields[0]);i++)
+    {
+        *fields[i] = arenaAlloc(loadArena, table->nPadded * sizeof(float));
+        memset(*fields[i], 0, table->nPadded * sizeof(float));
+    }
+    table->sortedX = arenaAlloc(loadArena, table->nPadded * sizeof(int));
+    table->reachX = arenaAlloc(loadArena, table->nPadded * sizeof(float));
+
+    for(i=0;i < nFaces;i++)
+        setCollisionFace(table, i, mapVectors[mapFaces->indices[i*3]], mapVectors[mapFaces->indices[i*3 + 1]], mapVectors[mapFaces->indices[i*3 + 2]], faceNormal(mapFaces, i));
+    for(i=0,k=nFaces;i < nInstances;i++)
+    {
+        mesh m = meshes[instances[i].mesh];
+        for(j=0;j < m.nFaces;j++,k++)
+            setCollisionFace(table, k, instancePoint(instances[i], m.vectors[m.faces[j].p1]), instancePoint(instances[i], m.vectors[m.faces[j].p2]),
+                             instancePoint(instances[i], m.vectors[m.faces[j].p3]), rotateZ(m.faces[j].norm, instances[i].yaw));
+    }
+    if(table->n > 0)
+        quicksort(table->sortedX, table->minX, 0, table->n - 1);
+    for(i=0;i < table->n;i++)
+        table->reachX[i] = i > 0 ? max(table->reachX[i - 1], table->maxX[table->sortedX[i]]) : table->maxX[table->sortedX[i]];
+
+    table->slack = 0;
+    for(i=0;i < table->n;i++) //u and v can each be COLLISION_EPSILON past the triangle, which moves the hit up to that much of both edges outside it
+        table->slack = max(table->slack, 3 * COLLISION_EPSILON * max(max(table->maxX[i] - table->minX[i], table->maxY[i] - table->minY[i]), table->maxZ[i] - table->minZ[i]));
+    table->slack += 1;
+
+    table->findHit = findCollisionScalar;
+#ifdef HAS_AVX_KERNELS
+    if(SDL_HasAVX())
+        table->findHit = findCollisionAVX;
+#endif
+}
+
+void setCollisionFace(collisionTable *table, int i, vec3 p1, vec3 p2, vec3 p3, vec3 norm) //fills in entry i of the table from a world space triangle
+{
+    vec3 t2 = sub(p2, p1);
+    vec3 t3 = sub(p3, p1);
+    vec3 h = unit(dropZ(norm));
+
+    table->minX[i] = min(min(p1.x, p2.x), p3.x);
+    table->maxX[i] = max(max(p1.x, p2.x), p3.x);
+    table->minY[i] = min(min(p1.y, p2.y), p3.y);
+    table->maxY[i] = max(max(p1.y, p2.y), p3.y);
+    table->minZ[i] = min(min(p1.z, p2.z), p3.z);
+    table->maxZ[i] = max(max(p1.z, p2.z), p3.z);
+    table->sortedX[i] = i;
+
+    float bot = dot(t2, t3) * dot(t2, t3) - dot(t2, t2) * dot(t3, t3);
+    if(bot == 0) //zero area triangle, leave its normal at zero so it is never hit
+        return;
+
+    table->nx[i] = norm.x;
+    table->ny[i] = norm.y;
+    table->nz[i] = norm.z;
+    table->planeD[i] = dot(p1, norm);
+    table->hx[i] = h.x;
+    table->hy[i] = h.y;
+    table->hn[i] = dot(h, norm);
+    table->px[i] = p1.x;
+    table->py[i] = p1.y;
+    table->pz[i] = p1.z;
+    table->t2x[i] = t2.x;
+    table->t2y[i] = t2.y;
+    table->t2z[i] = t2.z;
+    table->t3x[i] = t3.x;
+    table->t3y[i] = t3.y;
+    table->t3z[i] = t3.z;
+    table->d22[i] = dot(t2, t2);
+    table->d23[i] = dot(t2, t3);
+    table->d33[i] = dot(t3, t3);
+    table->invBot[i] = 1.0 / bot;
+}
+
+/*
+same test as clipVelocity against face i of the table, with the ray pushed radius away from the face sideways
+d holds the closest hit so far going in, and is set to the new distance along vel if this face is hit before it
+findCollisionAVX does the same float operations in the same order, so both find the same hits on every machine
+*/
+bool collisionTest(collisionTable *table, int i, vec3 origin, vec3 vel, float radius, float *d)
+{
+    float e = COLLISION_EPSILON, high = 1.0f + e;
+    float dn = vel.x * table->nx[i] + vel.y * table->ny[i] + vel.z * table->nz[i];
+    if(dn >= 0)
+        return false;
+    float hitD = (table->planeD[i] + radius * table->hn[i] - (origin.x * table->nx[i] + origin.y * table->ny[i] + origin.z * table->nz[i])) / dn;
+    if(!(hitD < *d && hitD >= -e))
+        return false;
+
+    float wx = origin.x + vel.x * hitD - radius * table->hx[i] - table->px[i];
+    float wy = origin.y + vel.y * hitD - radius * table->hy[i] - table->py[i];
+    float wz = origin.z + vel.z * hitD - table->pz[i];
+    float wt2 = wx * table->t2x[i] + wy * table->t2y[i] + wz * table->t2z[i];
+    float wt3 = wx * table->t3x[i] + wy * table->t3y[i] + wz * table->t3z[i];
+    float u = (table->d23[i] * wt2 - table->d22[i] * wt3) * table->invBot[i];
+    float v = (table->d23[i] * wt3 - table->d33[i] * wt2) * table->invBot[i];
+
+    if(u >= -e && u <= high && v >= -e && v <= high && u + v <= high)
+    {
+        *d = hitD;
+        return true;
+    }
+    return false;
+}
+
+/*
+returns the index of the face the ray from origin along vel hits first (and how far along vel in hitD), or -1 if it hits nothing
+*/
+int findCollisionScalar(collisionTable *table, vec3 origin, vec3 vel, float radius, float *hitD)
+{
+    int i, best = -1;
+    *hitD = 1;
+    for(i=0;i < table->n;i++)
+        if(collisionTest(table, i, origin, vel, radius, hitD))
+            best = i;
+    return best;
+}
+
+int findCollisionInList(collisionTable *table, int *list, int n, vec3 origin, vec3 vel, float radius, float *hitD) //same as above, only checking the faces in list
+{
+    int i, best = -1;
+    *hitD = 1;
+    for(i=0;i < n;i++)
+        if(collisionTest(table, list[i], origin, vel, radius, hitD))
+            best = list[i];
+    return best;
+}
+
+void fillContactCache(contactCache *cache, collisionTable *table, vec3 low, vec3 high) //gathers every face whose bounding box, grown by the table's slack, overlaps low to high
+{
+    float s = table->slack;
+    int i;
+    cache->low = low;
+    cache->high = high;
+    cache->filled = true;
+    cache->n = 0;
+    int first = 0, last = table->n;
+    while(first < last) //first face that could reach low.x
+    {
+        int middle = (first + last) / 2;
+        if(table->reachX[middle] + s < low.x)
+            first = middle + 1;
+        else
+            last = middle;
+    }
+    for(i=first;i < table->n && table->minX[table->sortedX[i]] - s <= high.x;i++)
+    {
+        int f = table->sortedX[i];
+        if(table->maxX[f] + s < low.x || table->minY[f] - s > high.y || table->maxY[f] + s < low.y || table->minZ[f] - s > high.z || table->maxZ[f] + s < low.z)
+            continue;
+        if(cache->n == CONTACT_CACHE_SIZE)
+        {
+            cache->n = -1;
+            return;
+        }
+        cache->faces[cache->n++] = f;
+    }
+
+    int j;
+    for(i=1;i < cache->n;i++) //back into index order, insertion sort since the cache is small
+    {
+        int f = cache->faces[i];
+        for(j=i;j > 0 && cache->faces[j - 1] > f;j--)
+            cache->faces[j] = cache->faces[j - 1];
+        cache->faces[j] = f;
+    }
+}
+
+void rayBounds(vec3 origin, vec3 vel, float d, float radius, vec3 *low, vec3 *high) //box around the ray from just behind origin to d along vel, pushed out radius sideways like the faces are
+{
+    vec3 back = sub(origin, mul(vel, COLLISION_EPSILON)); //hits can be a little behind the origin
+    vec3 end = add(origin, mul(vel, d));
+    *low = (vec3){min(back.x, end.x) - radius, min(back.y, end.y) - radius, min(back.z, end.z)};
+    *high = (vec3){max(back.x, end.x) + radius, max(back.y, end.y) + radius, max(back.z, end.z)};
+}
+
+/*
+finds the same hit as table->findHit, but only tests the faces in the cache, which is filled again if the ray could reach outside it
+the faces hit last tick go first, once one of them has been hit the rest of the cache is checked against the box of the shortened ray before the face test
+if the box has too many faces for the cache its reach is halved until they fit, only a box the ray alone overflows searches the whole table
+*/
+int findContact(contactCache *cache, collisionTable *table, vec3 origin, vec3 vel, float radius, float *hitD)
+{
+    vec3 low, high;
+    rayBounds(origin, vel, 1, radius, &low, &high);
+    if(!cache->filled || low.x < cache->low.x || low.y < cache->low.y || low.z < cache->low.z || high.x > cache->high.x || high.y > cache->high.y || high.z > cache->high.z)
+    {
+        while(true)
+        {
+            vec3 grow = {cache->reach, cache->reach, cache->reach};
+            fillContactCache(cache, table, sub(low, grow), add(high, grow));
+            if(cache->n >= 0 || cache->reach == 0)
+                break;
+            cache->reach = cache->reach > CONTACT_REACH / 8 ? cache->reach / 2 : 0; //a smaller box gets filled again sooner, but that's still cheaper than searching everything
+        }
+        if(cache->n >= 0 && cache->n <= CONTACT_CACHE_SIZE / 2) //out of the crowded part, so the next box can go further again
+            cache->reach = cache->reach > 0 ? min(cache->reach * 2, CONTACT_REACH) : CONTACT_REACH / 8;
+    }
+    if(cache->n < 0)
+        return table->findHit(table, origin, vel, radius, hitD);
+
+    int best = findCollisionInList(table, cache->recent, cache->nRecent, origin, vel, radius, hitD);
+    if(best >= 0) //nothing further than the hit can win
+        rayBounds(origin, vel, *hitD, radius, &low, &high);
+    float s = table->slack;
+    int i;
+    for(i=0;i < cache->n;i++)
+    {
+        int f = cache->faces[i];
+        if(best >= 0 && (table->minX[f] - s > high.x || table->maxX[f] + s < low.x || table->minY[f] - s > high.y || table->maxY[f] + s < low.y
+            || table->minZ[f] - s > high.z || table->maxZ[f] + s < low.z))
+            continue;
+        float d = f < best ? nextafterf(*hitD, INFINITY) : *hitD; //a face before best at the same distance would have won a full search
+        if(f != best && collisionTest(table, f, origin, vel, radius, &d))
+        {
+            best = f;
+            *hitD = d;
+        }
+    }
+    return best;
+}
+
+#ifdef HAS_AVX_KERNELS
+AVX_TARGET int findCollisionAVX(collisionTable *table, vec3 origin, vec3 vel, float radius, float *hitD)
+{
+    __m256 vx = _mm256_set1_ps(vel.x), vy = _mm256_set1_ps(vel.y), vz = _mm256_set1_ps(vel.z);
+    __m256 ox = _mm256_set1_ps(origin.x), oy = _mm256_set1_ps(origin.y), oz = _mm256_set1_ps(origin.z);
+    __m256 r = _mm256_set1_ps(radius);
+    __m256 zero = _mm256_setzero_ps();
+    float e = COLLISION_EPSILON; //the same float bounds as collisionTest
+    __m256 low = _mm256_set1_ps(-e);
+    __m256 high = _mm256_set1_ps(1.0f + e);
+    int i, best = -1;
+    float bestD = 1;
+    for(i=0;i < table->nPadded;i+=8)
+    {
+        __m256 nx = _mm256_load_ps(table->nx + i), ny = _mm256_load_ps(table->ny + i), nz = _mm256_load_ps(table->nz + i);
+        __m256 dn = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vx, nx), _mm256_mul_ps(vy, ny)), _mm256_mul_ps(vz, nz));
+        __m256 on = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ox, nx), _mm256_mul_ps(oy, ny)), _mm256_mul_ps(oz, nz));
+        __m256 planeD = _mm256_add_ps(_mm256_load_ps(table->planeD + i), _mm256_mul_ps(r, _mm256_load_ps(table->hn + i)));
+        __m256 d = _mm256_div_ps(_mm256_sub_ps(planeD, on), dn);
+        __m256 hit = _mm256_and_ps(_mm256_cmp_ps(dn, zero, _CMP_LT_OQ), _mm256_and_ps(_mm256_cmp_ps(d, _mm256_set1_ps(bestD), _CMP_LT_OQ), _mm256_cmp_ps(d, low, _CMP_GE_OQ)));
+        if(_mm256_movemask_ps(hit) == 0) //most blocks miss on the plane test, skip the barycentric part
+            continue;
+
+        __m256 wx = _mm256_sub_ps(_mm256_sub_ps(_mm256_add_ps(ox, _mm256_mul_ps(vx, d)), _mm256_mul_ps(r, _mm256_load_ps(table->hx + i))), _mm256_load_ps(table->px + i));
+        __m256 wy = _mm256_sub_ps(_mm256_sub_ps(_mm256_add_ps(oy, _mm256_mul_ps(vy, d)), _mm256_mul_ps(r, _mm256_load_ps(table->hy + i))), _mm256_load_ps(table->py + i));
+        __m256 wz = _mm256_sub_ps(_mm256_add_ps(oz, _mm256_mul_ps(vz, d)), _mm256_load_ps(table->pz + i));
+        __m256 wt2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(wx, _mm256_load_ps(table->t2x + i)), _mm256_mul_ps(wy, _mm256_load_ps(table->t2y + i))), _mm256_mul_ps(wz, _mm256_load_ps(table->t2z + i)));
+        __m256 wt3 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(wx, _mm256_load_ps(table->t3x + i)), _mm256_mul_ps(wy, _mm256_load_ps(table->t3y + i))), _mm256_mul_ps(wz, _mm256_load_ps(table->t3z + i)));
+        __m256 d23 = _mm256_load_ps(table->d23 + i);
+        __m256 invBot = _mm256_load_ps(table->invBot + i);
+        __m256 u = _mm256_mul_ps(_mm256_sub_ps(_mm256_mul_ps(d23, wt2), _mm256_mul_ps(_mm256_load_ps(table->d22 + i), wt3)), invBot);
+        __m256 v = _mm256_mul_ps(_mm256_sub_ps(_mm256_mul_ps(d23, wt3), _mm256_mul_ps(_mm256_load_ps(table->d33 + i), wt2)), invBot);
+
+        hit = _mm256_and_ps(hit, _mm256_and_ps(_mm256_cmp_ps(u, low, _CMP_GE_OQ), _mm256_cmp_ps(u, high, _CMP_LE_OQ)));
+        hit = _mm256_and_ps(hit, _mm256_and_ps(_mm256_cmp_ps(v, low, _CMP_GE_OQ), _mm256_cmp_ps(v, high, _CMP_LE_OQ)));
+        hit = _mm256_and_ps(hit, _mm256_cmp_ps(_mm256_add_ps(u, v), high, _CMP_LE_OQ));
+
+        int mask = _mm256_movemask_ps(hit);
+        if(mask)
+        {
+            float ds[8];
+            _mm256_storeu_ps(ds, d);
+            int j;
+            for(j=0;j < 8;j++)
+                if((mask & (1 << j)) && ds[j] < bestD)
+                {
+                    best = i + j;
+                    bestD = ds[j];
+                }
+        }
+    }
+    *hitD = bestD;
+    return best;
+}
+#endif
+
+void buildIcosahedron(mesh *m, int nColours, arena *loadArena) //unit radius icosahedron, each face gets the next map colour
+{
+    float p = (1.0 + sqrt(5.0)) / 2.0;
+    float s = 1.0 / sqrt(1.0 + p * p); //scale so every vertex is 1 from the origin
+    vec3 corners[12] = {{-1,p,0}, {1,p,0}, {-1,-p,0}, {1,-p,0}, {0,-1,p}, {0,1,p}, {0,-1,-p}, {0,1,-p}, {p,0,-1}, {p,0,1}, {-p,0,-1}, {-p,0,1}};
+    int tris[20][3] = {{0,11,5}, {0,5,1}, {0,1,7}, {0,7,10}, {0,10,11}, {1,5,9}, {5,11,4}, {11,10,2}, {10,7,6}, {7,1,8},
+                       {3,9,4}, {3,4,2}, {3,2,6}, {3,6,8}, {3,8,9}, {4,9,5}, {2,4,11}, {6,2,10}, {8,6,7}, {9,8,1}};
+
+    m->nVectors = 12;
+    m->nFaces = 20;
+    m->radius = 1;
+    m->vectors = arenaAlloc(loadArena, m->nVectors * sizeof(vec3));
+    m->faces = arenaAlloc(loadArena, m->nFaces * sizeof(face));
+    memset(m->faces, 0, m->nFaces * sizeof(face));
+
+    int i;
+    for(i=0;i < 12;i++)
+        m->vectors[i] = mul(corners[i], s);
+    for(i=0;i < 20;i++)
+    {
+        face *f = &m->faces[i];
+        f->p1 = tris[i][0];
+        f->p2 = tris[i][1];
+        f->p3 = tris[i][2];
+        f->texture = nColours > 0 ? i % nColours : 0;
+        f->type = 1;
+        f->mid = mul(add(m->vectors[f->p1], add(m->vectors[f->p2], m->vectors[f->p3])), 1.0/3.0);
+        f->norm = unit(cross(sub(m->vectors[f->p2], m->vectors[f->p1]), sub(m->vectors[f->p3], m->vectors[f->p1])));
+        if(dot(f->norm, f->mid) < 0) //point away from the middle
+            f->norm = mul(f->norm, -1);
+    }
+}
+
+void spawnEntities(entityStore *e, int n, int meshIndex, collisionTable *world, vec3 start, vec3 *mapVectors, int nVectors, arena *loadArena) //drops up to n icosahedra at random points inside the map that can be seen from start and have room above and below
+{
+    float **fields[] = {&e->px, &e->py, &e->pz, &e->vx, &e->vy, &e->vz, &e->radius, &e->lo, &e->hi};
+    int i;
+    for(i=0;i < sizeof(fields) / sizeof(fields[0]);i++)
+        *fields[i] = arenaAlloc(loadArena, max(n, 1) * sizeof(float));
+    e->mesh = arenaAlloc(loadArena, max(n, 1) * sizeof(int));
+    e->order = arenaAlloc(loadArena, max(n, 1) * sizeof(int));
+    e->n = 0;
+
+    vec3 low = nVectors > 0 ? mapVectors[0] : (vec3){0,0,0};
+    vec3 high = low;
+    for(i=1;i < nVectors;i++)
+    {
+        low = (vec3){min(low.x, mapVectors[i].x), min(low.y, mapVectors[i].y), min(low.z, mapVectors[i].z)};
+        high = (vec3){max(high.x, mapVectors[i].x), max(high.y, mapVectors[i].y), max(high.z, mapVectors[i].z)};
+    }
+
+    Uint32 seed = ENTITY_SEED; //same layout every run so replays see the same entities
+    int attempts;
+    for(attempts=0;attempts < n * 16 && e->n < n && nVectors > 0;attempts++) //the map doesn't have to fill its bounding box, so throw away points outside it or inside anything solid
+    {
+        vec3 pos = {low.x + ENTITY_RADIUS + (high.x - low.x - 2 * ENTITY_RADIUS) * randomUnit(&seed),
+                    low.y + ENTITY_RADIUS + (high.y - low.y - 2 * ENTITY_RADIUS) * randomUnit(&seed),
+                    low.z + ENTITY_RADIUS + (high.z - low.z - 2 * ENTITY_RADIUS) * randomUnit(&seed)};
+        vec3 down = {0, 0, high.z - low.z + 1};
+        float d, floorD, ceilingD;
+        if(world->findHit(world, start, sub(pos, start), ENTITY_RADIUS, &d) >= 0)
+            continue;
+        int floor = world->findHit(world, pos, down, 0, &floorD);
+        int ceiling = world->findHit(world, pos, mul(down, -1), 0, &ceilingD);
+        if(floor < 0 || ceiling < 0 || world->nz[floor] >= 0 || world->nz[ceiling] <= 0 || floorD * down.z <= ENTITY_RADIUS || ceilingD * down.z <= ENTITY_RADIUS)
+            continue;
+
+        i = e->n++;
+        e->radius[i] = ENTITY_RADIUS;
+        e->px[i] = pos.x;
+        e->py[i] = pos.y;
+        e->pz[i] = pos.z;
+        e->vx[i] = 10.0 * randomUnit(&seed) - 5;
+        e->vy[i] = 10.0 * randomUnit(&seed) - 5;
+        e->vz[i] = 0;
+        e->mesh[i] = meshIndex;
+        e->order[i] = i;
+    }
+}
+
+float randomUnit(Uint32 *seed) //0 to 1, steps a linear congruential generator (Numerical Recipes' constants) and takes its top 24 bits
+{
+    *seed = *seed * 1664525u + 1013904223u;
+    return (*seed >> 8) / 16777216.0f;
+}
+
+/*
+moves every entity one tick
+each entity's faces come from the collision table the same way as fillContactCache, by binary searching sortedX for the first face that reaches the x interval the entity can reach this tick
+entities are sorted by that interval and swept along x against each other, so the broadphase grows with the entities near each other rather than with the map
+entity-face pairs go through the same ray test as the player, entity-entity pairs are tested as spheres after moving
+*/
+void updateEntities(entityStore *e, collisionTable *world, arena *frameArena)
+{
+    int i, j, a, b;
+    for(i=0;i < e->n;i++)
+    {
+        e->vz[i] += ENTITY_GRAVITY;
+        float reach = e->radius[i] * 2; //the ray is pushed out by the radius, and the sphere reaches another radius past that
+        e->lo[i] = min(e->px[i], e->px[i] + e->vx[i]) - reach;
+        e->hi[i] = max(e->px[i], e->px[i] + e->vx[i]) + reach;
+    }
+
+    //faces each entity could hit, in sortedX order like the sweep this replaced found them
+    int *first = arenaAlloc(frameArena, (e->n + 1) * sizeof(int));
+    int maxCandidates = e->n * 16 + 64;
+    int *candidates = arenaAlloc(frameArena, maxCandidates * sizeof(int));
+    int nCandidates = 0;
+    for(i=0;i < e->n;i++)
+    {
+        float reach = e->radius[i] * 2;
+        float lowY = min(e->py[i], e->py[i] + e->vy[i]) - reach, highY = max(e->py[i], e->py[i] + e->vy[i]) + reach;
+        float lowZ = min(e->pz[i], e->pz[i] + e->vz[i]) - reach, highZ = max(e->pz[i], e->pz[i] + e->vz[i]) + reach;
+        first[i] = nCandidates;
+        int low = 0, high = world->n;
+        while(low < high) //first face that could reach lo
+        {
+            int middle = (low + high) / 2;
+            if(world->reachX[middle] < e->lo[i])
+                low = middle + 1;
+            else
+                high = middle;
+        }
+        for(b=low;b < world->n && world->minX[world->sortedX[b]] <= e->hi[i];b++)
+        {
+            int f = world->sortedX[b];
+            if(world->maxX[f] < e->lo[i] || world->maxY[f] < lowY || world->minY[f] > highY || world->maxZ[f] < lowZ || world->minZ[f] > highZ)
+                continue;
+            if(nCandidates == maxCandidates) //out of room, move to a bigger buffer
+            {
+                int *bigger = arenaAlloc(frameArena, maxCandidates * 2 * sizeof(int));
+                memcpy(bigger, candidates, nCandidates * sizeof(int));
+                candidates = bigger;
+                maxCandidates *= 2;
+            }
+            candidates[nCandidates++] = f;
+        }
+    }
+    first[e->n] = nCandidates;
+
+    for(a=1;a < e->n;a++) //insertion sort, the order barely changes between ticks so this is close to linear
+    {
+        int key = e->order[a];
+        for(b=a-1;b >= 0 && e->lo[e->order[b]] > e->lo[key];b--)
+            e->order[b+1] = e->order[b];
+        e->order[b+1] = key;
+    }
+
+    int *active = arenaAlloc(frameArena, max(e->n, 1) * sizeof(int));
+    int maxPairs = e->n * 8 + 64;
+    int *pairs = arenaAlloc(frameArena, maxPairs * 2 * sizeof(int)); //the entity added to the sweep, then the one it was already overlapping
+    int nPairs = 0, nActive = 0;
+    for(a=0;a < e->n;a++)
+    {
+        int ent = e->order[a];
+        for(b=0,j=0;b < nActive;b++) //drop anything that ended before this one starts
+            if(e->hi[active[b]] >= e->lo[ent])
+                active[j++] = active[b];
+        nActive = j;
+
+        float reach = e->radius[ent] * 2;
+        for(b=0;b < nActive;b++)
+        {
+            int other = active[b];
+            if(fabs(e->py[other] - e->py[ent]) > reach + e->radius[other] * 2 || fabs(e->pz[other] - e->pz[ent]) > reach + e->radius[other] * 2)
+                continue;
+            if(nPairs == maxPairs)
+            {
+                int *bigger = arenaAlloc(frameArena, maxPairs * 4 * sizeof(int));
+                memcpy(bigger, pairs, nPairs * 2 * sizeof(int));
+                pairs = bigger;
+                maxPairs *= 2;
+            }
+            pairs[nPairs * 2] = ent;
+            pairs[nPairs * 2 + 1] = other;
+            nPairs++;
+        }
+        active[nActive++] = ent;
+    }
+
+    for(b=0;b < nPairs;b++) //push overlapping entities apart, before clipping so the world always gets the last say
+    {
+        i = pairs[b * 2];
+        j = pairs[b * 2 + 1];
+        vec3 delta = {e->px[j] - e->px[i], e->py[j] - e->py[i], e->pz[j] - e->pz[i]};
+        float dist = length(delta);
+        float overlap = e->radius[i] + e->radius[j] - dist;
+        if(overlap <= 0)
+            continue;
+
+        vec3 norm = dist > 0 ? mul(delta, 1.0 / dist) : (vec3){1,0,0};
+        float separating = (e->vx[j] - e->vx[i]) * norm.x + (e->vy[j] - e->vy[i]) * norm.y + (e->vz[j] - e->vz[i]) * norm.z;
+        float push = max(overlap * ENTITY_PUSH - separating, 0) / 2; //only ever brings them up to a set separating speed so a crowd can't build up speed
+        e->vx[i] -= norm.x * push;
+        e->vy[i] -= norm.y * push;
+        e->vz[i] -= norm.z * push;
+        e->vx[j] += norm.x * push;
+        e->vy[j] += norm.y * push;
+        e->vz[j] += norm.z * push;
+    }
+
+    for(i=0;i < e->n;i++) //clip against the world the same way the player is, then move
+    {
+        vec3 vel = {e->vx[i], e->vy[i], e->vz[i]};
+        int iterations;
+        for(iterations=0;iterations < ENTITY_CLIP_ITERATIONS && first[i + 1] > first[i];iterations++)
+        {
+            //one ray from the middle for walls, and one from the top or bottom for ceilings and floors since a ray right along the bottom edge of a wall can slip past it
+            vec3 middle = {e->px[i], e->py[i], e->pz[i]};
+            vec3 edge = {e->px[i], e->py[i], e->pz[i] + (vel.z > 0 ? e->radius[i] : -e->radius[i])};
+            float d, edgeD;
+            int hit = findCollisionInList(world, candidates + first[i], first[i + 1] - first[i], middle, vel, e->radius[i], &d);
+            int edgeHit = vel.z != 0 ? findCollisionInList(world, candidates + first[i], first[i + 1] - first[i], edge, vel, e->radius[i], &edgeD) : -1;
+            if(edgeHit >= 0 && (hit < 0 || edgeD < d))
+            {
+                hit = edgeHit;
+                d = edgeD;
+            }
+            if(hit < 0)
+                break;
+            vec3 norm = {world->nx[hit], world->ny[hit], world->nz[hit]};
+            vel = sub(vel, mul(norm, dot(norm, mul(vel, 1.0 - d)) - COLLISION_EPSILON));
+        }
+        if(iterations == ENTITY_CLIP_ITERATIONS) //stuck in a corner, stay put rather than go through something
+            vel = (vec3){0,0,0};
+        e->vx[i] = vel.x;
+        e->vy[i] = vel.y;
+        e->vz[i] = vel.z;
+        e->px[i] += vel.x;
+        e->py[i] += vel.y;
+        e->pz[i] += vel.z;
+    }
+}
+
+int buildEntityInstances(entityStore *e, mesh *meshes, meshInstance *instances)
+{
+    int i;
+    for(i=0;i < e->n;i++)
+    {
+        instances[i].mesh = e->mesh[i];
+        instances[i].pos = (vec3){e->px[i], e->py[i], e->pz[i]};
+        instances[i].yaw = 0;
+        instances[i].scale = e->radius[i] / meshes[e->mesh[i]].radius;
+    }
+    return e->n;
+}
+
+/*
+replay file format (binary, native byte order):
+"IIRL", version (Uint32), starting camera as 11 floats in the same order as the first line of a map file
+then the settings the ticks depend on: map file name (30 chars, zero padded), sensitivity, entity radius and weld epsilon (floats), entity count and merge faces (Sint32)
+then one record per tick: keys (Uint16), xrel (Sint16), yrel (Sint16)
+the same input with any of those settings different takes the player somewhere else, so a replay is only played back with all of them the same
+*/
+
+bool writeReplayHeader(FILE *file, camera player)
+{
+    Uint32 version = REPLAY_VERSION;
+    float cam[11] = {player.pos.x, player.pos.y, player.pos.z, player.vel.x, player.vel.y, player.vel.z, player.pitch, player.yaw, player.speed, player.accel, player.decel};
+    char mapName[sizeof(MAP_FILE)] = {0};
+    snprintf(mapName, sizeof(mapName), "%s", MAP_FILE);
+    float settings[3] = {SENSITIVITY, ENTITY_RADIUS, WELD_EPSILON};
+    Sint32 counts[2] = {ENTITY_COUNT, MERGE_FACES};
+    return fwrite(REPLAY_MAGIC, 1, 4, file) == 4 && fwrite(&version, sizeof(Uint32), 1, file) == 1 && fwrite(cam, sizeof(float), 11, file) == 11
+        && fwrite(mapName, 1, sizeof(mapName), file) == sizeof(mapName) && fwrite(settings, sizeof(float), 3, file) == 3 && fwrite(counts, sizeof(Sint32), 2, file) == 2;
+}
+
+bool readReplayHeader(FILE *file, camera *player) //false if it isn't a replay of this version, or was recorded with different settings, which are printed
+{
+    char magic[4];
+    Uint32 version;
+    float cam[11];
+    if(fread(magic, 1, 4, file) != 4 || memcmp(magic, REPLAY_MAGIC, 4) != 0)
+        return false;
+    if(fread(&version, sizeof(Uint32), 1, file) != 1 || version != REPLAY_VERSION)
+        return false;
+    if(fread(cam, sizeof(float), 11, file) != 11)
+        return false;
+
+    char mapName[sizeof(MAP_FILE)];
+    float settings[3], current[3] = {SENSITIVITY, ENTITY_RADIUS, WELD_EPSILON};
+    Sint32 counts[2], currentCounts[2] = {ENTITY_COUNT, MERGE_FACES};
+    char *names[5] = {"sensitivity", "entity radius", "weld epsilon", "entities", "merge faces"};
+    if(fread(mapName, 1, sizeof(mapName), file) != sizeof(mapName) || fread(settings, sizeof(float), 3, file) != 3 || fread(counts, sizeof(Sint32), 2, file) != 2)
+        return false;
+    mapName[sizeof(mapName) - 1] = 0;
+    if(strcmp(mapName, MAP_FILE) != 0)
+    {
+        printf("replay was recorded on %s, not %s\n", mapName, MAP_FILE);
+        return false;
+    }
+    int i;
+    for(i=0;i < 3;i++)
+        if(settings[i] != current[i])
+        {
+            printf("replay was recorded with %s %g, settings have %g\n", names[i], settings[i], current[i]);
+            return false;
+        }
+    for(i=0;i < 2;i++)
+        if(counts[i] != currentCounts[i])
+        {
+            printf("replay was recorded with %s %d, settings have %d\n", names[i + 3], counts[i], currentCounts[i]);
+            return false;
+        }
+
+    camera r = {.pos = {cam[0], cam[1], cam[2]}, .vel = {cam[3], cam[4], cam[5]}, .pitch = cam[6], .yaw = cam[7], .speed = cam[8], .accel = cam[9], .decel = cam[10]};
+    *player = r;
+    return true;
+}
+
+bool writeTickInput(FILE *file, tickInput input)
+{
+    Sint16 record[3] = {input.keys, input.xrel, input.yrel};
+    return fwrite(record, sizeof(Sint16), 3, file) == 3;
+}
+
+bool readTickInput(FILE *file, tickInput *input)
+{
+    Sint16 record[3];
+    if(fread(record, sizeof(Sint16), 3, file) != 3)
+        return false;
+    input->keys = record[0];
+    input->xrel = record[1];
+    input->yrel = record[2];
+    return true;
+}
+
+/*
+capture file format (binary, native byte order):
+"IIRF", version (Uint32)
+then one record per captured frame: frame number (Uint32), width (Uint16), height (Uint16), kind (Uint8)
+CAPTURE_REPEAT has nothing after it, the frame was reused so it looks the same as the last one written
+CAPTURE_INDEXED has the palette (256 Uint32 RGB888), the size of what follows (Uint32), then the frame's palette indexes as (count, index) byte pairs, runs don't cross rows
+CAPTURE_RGB has width * height Uint32 RGB888 pixels, read back from the renderer when drawing in colour
+missing frame numbers were dropped because the writer was behind, a player should keep showing the frame before them
+*/
+
+bool frameCaptureInit(frameCapture *c, FILE *file, int width, int height, bool indexed) //writes the header and starts the writer, slots hold frames up to width x height
+{
+    memset(c, 0, sizeof(frameCapture));
+    c->file = file;
+    size_t size = (size_t)width * height * (indexed ? 1 : 4);
+    int i;
+    bool made = true;
+    for(i=0;i < CAPTURE_SLOTS;i++)
+        made = (c->slots[i].pixels = malloc(size)) && made;
+    c->packed = indexed ? malloc(size * 2) : NULL; //worst case every pixel is its own run
+    c->empty = SDL_CreateSemaphore(CAPTURE_SLOTS);
+    c->filled = SDL_CreateSemaphore(0);
+    Uint32 version = CAPTURE_VERSION;
+    if(made && (c->packed || !indexed) && c->empty && c->filled && fwrite(CAPTURE_MAGIC, 1, 4, file) == 4 && fwrite(&version, sizeof(Uint32), 1, file) == 1
+       && (c->thread = SDL_CreateThread(captureThread, "capture", c)))
+        return true;
+
+    for(i=0;i < CAPTURE_SLOTS;i++)
+        free(c->slots[i].pixels);
+    free(c->packed);
+    if(c->empty)
+        SDL_DestroySemaphore(c->empty);
+    if(c->filled)
+        SDL_DestroySemaphore(c->filled);
+    return false;
+}
+
+/*
+hands the frame just drawn to the writer, or drops it if every slot is still waiting to be written
+an indexed frame's pixels are swapped with the slot's, which are drawn over next frame, so only the palette is copied
+a colour frame has to be read back from the renderer into the slot, there's no way to take its pixels without a copy
+*/
+void captureFrame(frameCapture *c, int frame, bool reused, SDL_Renderer *renderer, SDL_Texture *renderTarget, indexedFrame *indexed)
+{
+    Uint64 start = SDL_GetPerformanceCounter();
+    if(SDL_SemTryWait(c->empty) != 0)
+    {
+        c->nDropped++;
+        if(!reused) //a reused frame can't be written as a repeat until this one has been
+            c->haveLast = false;
+        c->renderTime += (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+        return;
+    }
+
+    captureSlot *slot = &c->slots[c->head];
+    c->head = (c->head + 1) % CAPTURE_SLOTS;
+    slot->frame = frame;
+    slot->width = WIDTH;
+    slot->height = HEIGHT;
+    if(reused && c->haveLast)
+        slot->kind = CAPTURE_REPEAT;
+    else if(indexed) //a dropped frame is still in indexed->pixels, reused frames don't draw over it
+    {
+        Uint8 *hold = indexed->pixels;
+        indexed->pixels = slot->pixels;
+        slot->pixels = hold;
+        slot->pitch = indexed->width;
+        memcpy(slot->palette, indexed->palette, sizeof(slot->palette));
+        slot->kind = CAPTURE_INDEXED;
+    }
+    else
+    {
+        SDL_Rect area = {0, 0, WIDTH, HEIGHT};
+        if(renderTarget) //a reused frame doesn't set it
+            SDL_SetRenderTarget(renderer, renderTarget);
+        slot->pitch = WIDTH * 4;
+        SDL_RenderReadPixels(renderer, &area, SDL_PIXELFORMAT_RGB888, slot->pixels, slot->pitch);
+        slot->kind = CAPTURE_RGB;
+    }
+    c->haveLast = true;
+    SDL_SemPost(c->filled);
+    c->renderTime += (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+void frameCaptureFinish(frameCapture *c) //waits for the writer to get through every frame handed to it, then frees the slots
+{
+    SDL_SemWait(c->empty);
+    c->slots[c->head].kind = CAPTURE_END;
+    SDL_SemPost(c->filled);
+    SDL_WaitThread(c->thread, NULL);
+
+    int nCalls = c->nWritten + c->nDropped;
+    printf("captured %d frames, %d dropped, %0.3f ms average on the render thread%s\n", c->nWritten, c->nDropped, nCalls > 0 ? c->renderTime / nCalls : 0.0, c->failed ? ", stopped by a write error" : "");
+    int i;
+    for(i=0;i < CAPTURE_SLOTS;i++)
+        free(c->slots[i].pixels);
+    free(c->packed);
+    SDL_DestroySemaphore(c->empty);
+    SDL_DestroySemaphore(c->filled);
+}
+
+int captureThread(void *data) //writes slots in the order they were filled until it reaches the end marker
+{
+    frameCapture *c = data;
+    SDL_SetThreadPriority(SDL_THREAD_PRIORITY_LOW); //the frames being drawn matter more than getting the last ones written quickly
+    while(true)
+    {
+        SDL_SemWait(c->filled);
+        captureSlot *slot = &c->slots[c->tail];
+        c->tail = (c->tail + 1) % CAPTURE_SLOTS;
+        if(slot->kind == CAPTURE_END)
+            break;
+        if(!c->failed && writeCaptureFrame(c->file, slot, c->packed))
+            c->nWritten++;
+        else
+            c->failed = true;
+        SDL_SemPost(c->empty);
+    }
+    return 0;
+}
+
+bool writeCaptureFrame(FILE *file, captureSlot *slot, Uint8 *packed)
+{
+    Uint32 frame = slot->frame;
+    Uint16 size[2] = {slot->width, slot->height};
+    Uint8 kind = slot->kind;
+    if(fwrite(&frame, sizeof(Uint32), 1, file) != 1 || fwrite(size, sizeof(Uint16), 2, file) != 2 || fwrite(&kind, 1, 1, file) != 1)
+        return false;
+
+    int y;
+    if(slot->kind == CAPTURE_INDEXED)
+    {
+        Uint32 nPacked = 0;
+        for(y=0;y < slot->height;y++)
+            nPacked += packRuns(slot->pixels + y * slot->pitch, slot->width, packed + nPacked);
+        return fwrite(slot->palette, sizeof(Uint32), 256, file) == 256 && fwrite(&nPacked, sizeof(Uint32), 1, file) == 1 && fwrite(packed, 1, nPacked, file) == nPacked;
+    }
+    if(slot->kind == CAPTURE_RGB)
+        return fwrite(slot->pixels, 4, slot->width * slot->height, file) == slot->width * slot->height; //rows were read back without any padding
+    return true;
+}
+
+int packRuns(Uint8 *src, int n, Uint8 *dst) //run length encodes n bytes as (count, value) pairs, returns the bytes written
+{
+    int i = 0, nOut = 0;
+    while(i < n)
+    {
+        int run = 1;
+        while(i + run < n && run < 255 && src[i + run] == src[i])
+            run++;
+        dst[nOut++] = run;
+        dst[nOut++] = src[i];
+        i += run;
+    }
+    return nOut;
+}
+
+/*
+map file format:
+player.pos.x,player.pos.y,player.pos.z,player.vel.x,player.vel.y,player.vel.z,player.pitch,player.yaw,player.speed,player.accel,player.decel
+num_of_vertices,num_of_faces,num_of_colours
+vec0.x,vec0.y,vec0.z
+vec1.x,vec1.y,vec1.z
+vec2.x,vec2.y,vec2.z&(*player)
+...
+face0.p1,face0.p2,face0.p3,face0.texture,face0.norm.x,face0.norm.y,face0.norm.z,face0.type,face0.flags
+face1.p1,face1.p2,face1.p3,face1.texture,face1.norm.x,face1.norm.y,face1.norm.z,face1.type,face1.flags
+...
+*/
+
+/*
+since calculating the surface normals for every face manually can be tedious, it is calculated by taking the cross product of the vectors p0-p1 and p0-p2
+the type is used to determine whether the face normal points towards the origin or away (0 towards, 1 away)
+*/
+
+/*
+after the textures a map can list meshes that are drawn in more than one place, the line "nMeshes,nInstances" starts the section
+each mesh is "nVectors,nFaces" then its vectors and faces in the same format as the map's, with vertex indexes counting from the mesh's first vector
+each instance is "mesh,x,y,z,yaw,scale"
+*/
+void loadMap(int *nVectors, int *nColors, vec3 **vectors, faceTable *faces, colour **colours, char *fileName, camera *player, char ***textureNames, int *nTextures, int *nMeshes, mesh **meshes, int *nInstances, meshInstance **instances) //textures are only named here, see loadTexturesThread
+{
+    FILE *mapFile = fopen(fileName, "r");
+    fscanf(mapFile,"%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f\n", &(*player).pos.x, &(*player).pos.y, &(*player).pos.z, &(*player).vel.x, &(*player).vel.y, &(*player).vel.z, &(*player).pitch, &(*player).yaw, &(*player).speed, &(*player).accel, &(*player).decel);
+    int nFaces;
+    *nTextures = 0; //maps without textures leave the count off
+    fscanf(mapFile,"%d,%d,%d,%d\n",nVectors,&nFaces,nColors,nTextures);
+    *vectors = (vec3 *)malloc(*nVectors * sizeof(vec3));
+    faceTableInit(faces, nFaces);
+    *colours = (colour *)malloc(*nColors * sizeof(colour));
+    *textureNames = (char **)malloc(max(*nTextures, 1) * sizeof(char *));
+
+    int i;
+    for(i=0;i < *nVectors;i++)
+        fscanf(mapFile,"%f,%f,%f\n",&(*vectors)[i].x, &(*vectors)[i].y, &(*vectors)[i].z);
+    for(i=0;i < nFaces;i++)
+    {
+        face f;
+        if(!readFace(mapFile, &f, *vectors, *nVectors))
+            printf("%s: face %d points past the %d vertices, it's left out\n", fileName, i, *nVectors);
+        setFace(faces, i, f, *vectors);
+    }
+    *nVectors = weldVectors(*vectors, *nVectors, faces);
+    removeDegenerateFaces(faces, *vectors);
+    splitTJunctions(faces, *vectors, *nVectors);
+    mergeFacePolygons(faces, *vectors, *nVectors);
+    buildFaceClusters(faces, *vectors, *nVectors);
+    pairOccluderFaces(faces, *vectors, *nVectors);
+    for(i=0;i < *nColors;i++)
+        fscanf(mapFile,"%d,%d,%d\n", &(*colours)[i].r, &(*colours)[i].g, &(*colours)[i].b);
+    char tempString[30];
+    for(i=0;i < *nTextures;i++)
+    {
+        fscanf(mapFile,"%29[^\n]\n",tempString);
+        (*textureNames)[i] = (char *)malloc(strlen(tempString) + 1);
+        strcpy((*textureNames)[i], tempString);
+    }
+
+    *nMeshes = 0;
+    *nInstances = 0;
+    if(fscanf(mapFile,"%d,%d\n",nMeshes,nInstances) != 2) //older maps stop here
+        *nMeshes = *nInstances = 0;
+    *meshes = (mesh *)malloc(max(*nMeshes, 1) * sizeof(mesh));
+    *instances = (meshInstance *)malloc(max(*nInstances, 1) * sizeof(meshInstance));
+    for(i=0;i < *nMeshes;i++)
+    {
+        mesh *m = &(*meshes)[i];
+        fscanf(mapFile,"%d,%d\n",&m->nVectors,&m->nFaces);
+        m->vectors = (vec3 *)malloc(m->nVectors * sizeof(vec3));
+        m->faces = (face *)malloc(m->nFaces * sizeof(face));
+        m->radius = 0;
+        int j;
+        for(j=0;j < m->nVectors;j++)
+        {
+            fscanf(mapFile,"%f,%f,%f\n",&m->vectors[j].x, &m->vectors[j].y, &m->vectors[j].z);
+            m->radius = max(m->radius, length(m->vectors[j]));
+        }
+        int nFaces = m->nFaces;
+        for(j=0,m->nFaces=0;j < nFaces;j++)
+        {
+            if(readFace(mapFile, &m->faces[m->nFaces], m->vectors, m->nVectors))
+                m->nFaces++;
+            else
+                printf("%s: face %d of mesh %d points past its %d vertices, it's left out\n", fileName, j, i, m->nVectors);
+        }
+    }
+    int nRead = *nInstances;
+    for(i=0,*nInstances=0;i < nRead;i++)
+    {
+        meshInstance *instance = &(*instances)[*nInstances];
+        fscanf(mapFile,"%d,%f,%f,%f,%f,%f\n", &instance->mesh, &instance->pos.x, &instance->pos.y, &instance->pos.z, &instance->yaw, &instance->scale);
+        if(instance->mesh < 0 || instance->mesh >= *nMeshes)
+            printf("%s: instance %d is of mesh %d, there are only %d, it's left out\n", fileName, i, instance->mesh, *nMeshes);
+        else
+            (*nInstances)++;
+    }
+
+    fclose(mapFile);
+}
+
+void startMapLoad(mapLoader *l, char *fileName)
+{
+    memset(l, 0, sizeof(mapLoader));
+    l->fileName = fileName;
+    l->startTime = SDL_GetTicks();
+    l->thread = SDL_CreateThread(loadMapThread, "loadMap", l);
+    if(!l->thread) //no threads, load it all now instead
+        loadMapThread(l);
+}
+
+/*
+reads the map, starts the texture threads, then builds everything else from the map while they decode
+drawing and collision can start at LOAD_READY, textured faces are drawn flat until their texture arrives
+*/
+int loadMapThread(void *data)
+{
+    mapLoader *l = data;
+    loadMap(&l->nVectors, &l->nColours, &l->vectors, &l->faces, &l->colours, l->fileName, &l->player, &l->textureNames, &l->nTextures, &l->nMeshes, &l->meshes, &l->nInstances, &l->instances);
+    l->textures = (SDL_Surface **)calloc(max(l->nTextures, 1), sizeof(SDL_Surface *));
+    SDL_AtomicSet(&l->stage, LOAD_BUILDING);
+
+    int nThreads = clamp(SDL_GetCPUCount() - 1, 1, MAX_TEXTURE_THREADS);
+    for(l->nTextureThreads=0;l->nTextureThreads < min(nThreads, l->nTextures);l->nTextureThreads++)
+        if(!(l->textureThreads[l->nTextureThreads] = SDL_CreateThread(loadTexturesThread, "loadTextures", l)))
+            break;
+
+    int i, nInstanceFaces = 0;
+    for(i=0;i < l->nInstances;i++)
+        nInstanceFaces += l->meshes[l->instances[i].mesh].nFaces;
+    arenaInit(&l->loadArena, (l->faces.n + nInstanceFaces + 8) * (sizeof(face) + 30 * sizeof(float)) + l->nVectors * sizeof(vec3) + ENTITY_COUNT * 11 * sizeof(float) + (l->nInstances + ENTITY_COUNT) * 4 * sizeof(meshInstance) + 20 * sizeof(face) + 12 * sizeof(vec3) + 40 * ARENA_ALIGN);
+    buildCollisionTable(&l->collision, &l->faces, l->vectors, l->meshes, l->instances, l->nInstances, &l->loadArena);
+
+    l->allMeshes = arenaAlloc(&l->loadArena, (l->nMeshes + 1) * sizeof(mesh));
+    memcpy(l->allMeshes, l->meshes, l->nMeshes * sizeof(mesh));
+    buildIcosahedron(&l->allMeshes[l->nMeshes], l->nColours, &l->loadArena);
+    spawnEntities(&l->entities, ENTITY_COUNT, l->nMeshes, &l->collision, l->player.pos, l->vectors, l->nVectors, &l->loadArena);
+
+    if(l->nTextureThreads == 0) //couldn't start any, do them here
+        loadTexturesThread(l);
+    SDL_AtomicSet(&l->stage, LOAD_READY);
+    return 0;
+}
+
+int loadTexturesThread(void *data) //takes textures off the list until there are none left
+{
+    mapLoader *l = data;
+    int i;
+    while((i = SDL_AtomicAdd(&l->nextTexture, 1)) < l->nTextures)
+    {
+        SDL_Surface *texture = SDL_LoadBMP(l->textureNames[i]);
+        if(!texture)
+            printf("could not load texture %s\n", l->textureNames[i]);
+        SDL_AtomicSetPtr((void **)&l->textures[i], texture);
+        SDL_AtomicAdd(&l->nTexturesDone, 1);
+    }
+    return 0;
+}
+
+void finishMapLoad(mapLoader *l) //waits for every loading thread
+{
+    if(l->thread)
+        SDL_WaitThread(l->thread, NULL);
+    l->thread = NULL;
+    int i;
+    for(i=0;i < l->nTextureThreads;i++)
+        SDL_WaitThread(l->textureThreads[i], NULL);
+    l->nTextureThreads = 0;
+}
+
+void freeMap(mapLoader *l)
+{
+    finishMapLoad(l);
+    int i;
+    for(i=0;i < l->nTextures;i++)
+    {
+        if(l->textures[i])
+            SDL_FreeSurface(l->textures[i]);
+        free(l->textureNames[i]);
+    }
+    for(i=0;i < l->nMeshes;i++)
+    {
+        free(l->meshes[i].vectors);
+        free(l->meshes[i].faces);
+    }
+
+    free(l->vectors);
+    faceTableFree(&l->faces);
+    free(l->colours);
+    free(l->textures);
+    free(l->textureNames);
+    free(l->meshes);
+    free(l->instances);
+    arenaFree(&l->loadArena);
+}
+
+float loadProgress(mapLoader *l) //0 to 1, half for the geometry and half for the textures
+{
+    int stage = SDL_AtomicGet(&l->stage);
+    if(stage == LOAD_PARSING)
+        return 0;
+    return (stage == LOAD_READY ? 0.5 : 0.25) + 0.5 * SDL_AtomicGet(&l->nTexturesDone) / max(l->nTextures, 1);
+}
+
+void drawLoadingBar(SDL_Renderer *renderer, int y, float progress) //across the middle half of the window at window resolution, centred on y
+{
+    SDL_Rect outline = {WINDOW_WIDTH/4, y - LOADING_BAR_HEIGHT/2, WINDOW_WIDTH/2, LOADING_BAR_HEIGHT};
+    SDL_Rect filled = outline;
+    filled.w = outline.w * clamp(progress, 0, 1);
+    SDL_SetRenderDrawColor(renderer, CROSSHAIR_R, CROSSHAIR_G, CROSSHAIR_B, SDL_ALPHA_OPAQUE);
+    SDL_RenderDrawRect(renderer, &outline);
+    SDL_RenderFillRect(renderer, &filled);
+}
+
+/*
+one face line of a map file, vectors are the nVectors its indexes point into
+false if any of them is outside, the face is then given three of the same corner so it covers nothing and is dropped along with the other degenerate faces
+*/
+bool readFace(FILE *file, face *f, vec3 *vectors, int nVectors)
+{
+    f->flags = 0; //older maps stop after the type, and an untouched flag could mark the face textured
+    f->uv1 = f->uv2 = f->uv3 = (vec2){0, 0};
+    fscanf(file,"%d,%d,%d,%d,%f,%f,%f,%d,%d,%f,%f,%f,%f,%f,%f\n", &f->p1, &f->p2, &f->p3, &f->texture, &f->norm.x, &f->norm.y, &f->norm.z, &f->type, &f->flags, &f->uv1.x, &f->uv1.y, &f->uv2.x, &f->uv2.y, &f->uv3.x, &f->uv3.y);
+    if(f->p1 < 0 || f->p1 >= nVectors || f->p2 < 0 || f->p2 >= nVectors || f->p3 < 0 || f->p3 >= nVectors)
+    {
+        f->p1 = f->p2 = f->p3 = 0;
+        f->mid = f->norm = (vec3){0, 0, 0};
+        return false;
+    }
+    f->mid = mul(add(vectors[f->p1],add(vectors[f->p2],vectors[f->p3])), 1.0/3.0);
+    if(GENERATE_FACE_NORMALS)
+    {
+        f->norm = unit(cross(sub(vectors[f->p2], vectors[f->p1]), sub(vectors[f->p3], vectors[f->p1])));
+        //f->norm = unit(mul(f->norm, dot(f->norm,f->mid) * (f->type * 2 - 1)));
+        f->norm = orientNormal(f->norm, f->mid, f->type);
+    }
+    return true;
+}
+
+vec3 orientNormal(vec3 norm, vec3 mid, int type) //points a face's normal towards the origin for type 0 or away from it for type 1
+{
+    if(((dot(norm, mid) <= 0) == type) || (dot(norm, mid) == 0 && norm.z > 0))
+        return mul(norm, -1);
+    return norm;
+}
+
+/*
+test maps at any size, for finding out how things scale past the few dozen faces of the hand made maps
+sphere is an icosahedron subdivided until it has enough faces, seen from the inside
+rooms is a square grid of rooms with four pillars each and walls around the outside
+soup is random triangles facing random ways in a cube, the same ones every time for the same count
+*/
+bool generateMap(generatedMap *m, char *kind, int nFaces)
+{
+    memset(m, 0, sizeof(generatedMap));
+    m->player.speed = 15;
+    m->player.accel = 1.2;
+    m->player.decel = 1.2;
+    nFaces = max(nFaces, 1);
+    if(strcmp(kind, "sphere") == 0)
+        generateSphere(m, nFaces);
+    else if(strcmp(kind, "rooms") == 0)
+        generateRooms(m, nFaces);
+    else if(strcmp(kind, "soup") == 0)
+        generateSoup(m, nFaces);
+    else
+    {
+        printf("unknown map kind %s, can be sphere, rooms or soup\n", kind);
+        return false;
+    }
+    return true;
+}
+
+bool writeGeneratedMap(generatedMap *m, char *fileName) //floats are written with enough digits to read back exactly, so the normals come out the way genFace worked them out
+{
+    FILE *file = fopen(fileName, "w");
+    if(!file)
+    {
+        printf("could not write %s\n", fileName);
+        return false;
+    }
+    camera *p = &m->player;
+    fprintf(file, "%.9g,%.9g,%.9g,0,0,0,%.9g,%.9g,%.9g,%.9g,%.9g\n", p->pos.x, p->pos.y, p->pos.z, p->pitch, p->yaw, p->speed, p->accel, p->decel);
+    fprintf(file, "%d,%d,%d,0\n", m->nVectors, m->nFaces, GENERATED_COLOURS);
+    int i;
+    for(i=0;i < m->nVectors;i++)
+        fprintf(file, "%.9g,%.9g,%.9g\n", m->vectors[i].x, m->vectors[i].y, m->vectors[i].z);
+    for(i=0;i < m->nFaces;i++)
+    {
+        int *f = &m->faces[i*5];
+        fprintf(file, "%d,%d,%d,%d,0,0,0,%d,0,0,0,0,0,0,0\n", f[0], f[1], f[2], f[3], f[4]);
+    }
+    int colours[GENERATED_COLOURS][3] = {{90,90,100}, {60,60,70}, {170,120,80}, {120,140,160}};
+    for(i=0;i < GENERATED_COLOURS;i++)
+        fprintf(file, "%d,%d,%d\n", colours[i][0], colours[i][1], colours[i][2]);
+    fclose(file);
+    return true;
+}
+
+void freeGeneratedMap(generatedMap *m)
+{
+    free(m->vectors);
+    free(m->faces);
+    memset(m, 0, sizeof(generatedMap));
+}
+
+int genVector(generatedMap *m, vec3 v) //returns the new vector's index
+{
+    if(m->nVectors == m->maxVectors)
+    {
+        m->maxVectors = max(m->maxVectors * 2, 64);
+        m->vectors = realloc(m->vectors, m->maxVectors * sizeof(vec3));
+    }
+    m->vectors[m->nVectors] = v;
+    return m->nVectors++;
+}
+
+/*
+adds a face whose normal points along facing once it's loaded
+the normal is worked out the same way readFace does it, trying both types and then the other winding, degenerate faces are left out
+*/
+void genFace(generatedMap *m, int p1, int p2, int p3, int colour, vec3 facing)
+{
+    if(m->nFaces == m->maxFaces)
+    {
+        m->maxFaces = max(m->maxFaces * 2, 64);
+        m->faces = realloc(m->faces, m->maxFaces * 5 * sizeof(int));
+    }
+    vec3 *v = m->vectors;
+    int winding, type;
+    for(winding=0;winding < 2;winding++)
+    {
+        vec3 norm = unit(cross(sub(v[p2], v[p1]), sub(v[p3], v[p1])));
+        vec3 mid = mul(add(v[p1],add(v[p2],v[p3])), 1.0/3.0);
+        for(type=0;type < 2;type++)
+            if(dot(orientNormal(norm, mid, type), facing) > 0)
+            {
+                int *f = &m->faces[m->nFaces++ * 5];
+                f[0] = p1;
+                f[1] = p2;
+                f[2] = p3;
+                f[3] = colour;
+                f[4] = type;
+                return;
+            }
+        int hold = p2;
+        p2 = p3;
+        p3 = hold;
+    }
+}
+
+void genQuad(generatedMap *m, vec3 a, vec3 b, vec3 c, vec3 d, int colour, vec3 facing) //a to d go round the edge, split along a to c
+{
+    int ia = genVector(m, a), ib = genVector(m, b), ic = genVector(m, c), id = genVector(m, d);
+    genFace(m, ia, ib, ic, colour, facing);
+    genFace(m, ia, ic, id, colour, facing);
+}
+
+void generateSphere(generatedMap *m, int nFaces) //each step splits every face into 4 at its edge midpoints, which are shared through a hash table of edges
+{
+    arena scratch;
+    arenaInit(&scratch, 4096);
+    mesh ico;
+    buildIcosahedron(&ico, 1, &scratch);
+
+    int n = ico.nFaces;
+    while(n < nFaces)
+        n *= 4;
+    float radius = 60 * sqrt(n); //keeps the faces about the same size whatever the count
+    int *tris = malloc(n * 3 * sizeof(int));
+    int *next = malloc(n * 3 * sizeof(int));
+    int i, j;
+    for(i=0;i < ico.nVectors;i++)
+        genVector(m, mul(ico.vectors[i], radius));
+    for(i=0;i < ico.nFaces;i++)
+    {
+        tris[i*3] = ico.faces[i].p1;
+        tris[i*3 + 1] = ico.faces[i].p2;
+        tris[i*3 + 2] = ico.faces[i].p3;
+    }
+    arenaFree(&scratch);
+
+    int nTris = ico.nFaces;
+    while(nTris < n)
+    {
+        int tableSize = 1;
+        while(tableSize < nTris * 4) //3 edges a face, each shared by 2 faces, so the table stays under half full
+            tableSize *= 2;
+        int *table = malloc(tableSize * 3 * sizeof(int)); //lower vertex, higher vertex, midpoint, lower is -1 for empty slots
+        for(i=0;i < tableSize;i++)
+            table[i*3] = -1;
+
+        for(i=0;i < nTris;i++)
+        {
+            int mids[3];
+            for(j=0;j < 3;j++)
+            {
+                int a = min(tris[i*3 + j], tris[i*3 + (j+1)%3]), b = max(tris[i*3 + j], tris[i*3 + (j+1)%3]);
+                int slot = ((unsigned)a * 73856093u ^ (unsigned)b * 19349663u) & (tableSize - 1);
+                while(table[slot*3] != -1 && (table[slot*3] != a || table[slot*3 + 1] != b))
+                    slot = (slot + 1) & (tableSize - 1);
+                if(table[slot*3] == -1)
+                {
+                    table[slot*3] = a;
+                    table[slot*3 + 1] = b;
+                    table[slot*3 + 2] = genVector(m, mul(unit(add(m->vectors[a], m->vectors[b])), radius));
+                }
+                mids[j] = table[slot*3 + 2];
+            }
+            int split[4][3] = {{tris[i*3], mids[0], mids[2]}, {mids[0], tris[i*3 + 1], mids[1]}, {mids[2], mids[1], tris[i*3 + 2]}, {mids[0], mids[1], mids[2]}};
+            memcpy(&next[i*12], split, sizeof(split));
+        }
+        free(table);
+        int *hold = tris;
+        tris = next;
+        next = hold;
+        nTris *= 4;
+    }
+
+    for(i=0;i < nTris;i++)
+    {
+        vec3 mid = add(m->vectors[tris[i*3]], add(m->vectors[tris[i*3 + 1]], m->vectors[tris[i*3 + 2]]));
+        genFace(m, tris[i*3], tris[i*3 + 1], tris[i*3 + 2], i % GENERATED_COLOURS, mul(mid, -1)); //facing the middle
+    }
+    free(tris);
+    free(next);
+}
+
+void generateRooms(generatedMap *m, int nFaces) //36 faces a room, +z is down so the floor is at 0 and the ceiling above it
+{
+    int n = max(sqrt(nFaces / 36.0), 1);
+    float size = GENERATED_ROOM_SIZE, top = -GENERATED_ROOM_HEIGHT, pillar = 50;
+    vec3 up = {0,0,-1}, down = {0,0,1};
+    int x, y, i;
+    for(x=0;x < n;x++)
+        for(y=0;y < n;y++)
+        {
+            float x0 = x * size, y0 = y * size, x1 = x0 + size, y1 = y0 + size;
+            genQuad(m, (vec3){x0,y0,0}, (vec3){x1,y0,0}, (vec3){x1,y1,0}, (vec3){x0,y1,0}, 0, up);
+            genQuad(m, (vec3){x0,y0,top}, (vec3){x1,y0,top}, (vec3){x1,y1,top}, (vec3){x0,y1,top}, 1, down);
+            for(i=0;i < 4;i++) //pillars a quarter of the way in from each corner
+            {
+                vec3 centre = {x0 + size * (i & 1 ? 0.75 : 0.25), y0 + size * (i & 2 ? 0.75 : 0.25), 0};
+                vec3 corners[4] = {{centre.x - pillar, centre.y - pillar, 0}, {centre.x + pillar, centre.y - pillar, 0}, {centre.x + pillar, centre.y + pillar, 0}, {centre.x - pillar, centre.y + pillar, 0}};
+                int k;
+                for(k=0;k < 4;k++)
+                {
+                    vec3 a = corners[k], b = corners[(k+1)%4];
+                    genQuad(m, a, b, (vec3){b.x, b.y, top}, (vec3){a.x, a.y, top}, 2, dropZ(sub(mul(add(a, b), 0.5), centre)));
+                }
+            }
+        }
+
+    float far = n * size;
+    for(i=0;i < n;i++) //outside walls, facing in
+    {
+        float a = i * size, b = a + size;
+        genQuad(m, (vec3){a,0,0}, (vec3){b,0,0}, (vec3){b,0,top}, (vec3){a,0,top}, 3, (vec3){0,1,0});
+        genQuad(m, (vec3){a,far,0}, (vec3){b,far,0}, (vec3){b,far,top}, (vec3){a,far,top}, 3, (vec3){0,-1,0});
+        genQuad(m, (vec3){0,a,0}, (vec3){0,b,0}, (vec3){0,b,top}, (vec3){0,a,top}, 3, (vec3){1,0,0});
+        genQuad(m, (vec3){far,a,0}, (vec3){far,b,0}, (vec3){far,b,top}, (vec3){far,a,top}, 3, (vec3){-1,0,0});
+    }
+
+    m->player.pos = (vec3){size / 2, size / 2, top / 2};
+    m->player.yaw = 0;
+}
+
+void generateSoup(generatedMap *m, int nFaces) //triangles about 200 across, spread so there's roughly the same space around each whatever the count
+{
+    srand(nFaces);
+    float side = 400 * cbrt(nFaces);
+    int i, j;
+    for(i=0;i < nFaces;i++)
+    {
+        vec3 centre = {side * rand() / (float)RAND_MAX, side * rand() / (float)RAND_MAX, -side * rand() / (float)RAND_MAX};
+        int p[3];
+        for(j=0;j < 3;j++)
+            p[j] = genVector(m, add(centre, (vec3){200.0 * rand() / RAND_MAX - 100, 200.0 * rand() / RAND_MAX - 100, 200.0 * rand() / RAND_MAX - 100}));
+        vec3 facing = {rand() / (float)RAND_MAX - 0.5, rand() / (float)RAND_MAX - 0.5, rand() / (float)RAND_MAX - 0.5};
+        genFace(m, p[0], p[1], p[2], i % GENERATED_COLOURS, facing);
+    }
+    m->player.pos = (vec3){side / 2, side / 2, -side / 2};
+}
+
+/*
+-bench, each benchmark goes up in size by 4 times until BENCH_MAX_SECONDS or max faces, and prints the rate at each size so the way it scales can be compared between builds
+nothing here needs a window, the rasterizer draws into a software renderer
+*/
+int runBenchmarks(int maxFaces)
+{
+    maxFaces = max(maxFaces, 1024);
+    printf("benchmarks up to %d faces\n", maxFaces);
+    benchRaster();
+    benchQuicksort(maxFaces);
+    benchMaps(maxFaces);
+    benchDrawFaces(maxFaces);
+    return 0;
+}
+
+double benchTime(Uint64 start) //seconds since start
+{
+    return (double)(SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency();
+}
+
+void benchRaster(void) //right angled triangles of a few sizes, spread over the screen, through the renderer and then the indexed framebuffer
+{
+    WIDTH = BENCH_WIDTH;
+    HEIGHT = BENCH_HEIGHT;
+    SDL_Surface *target = SDL_CreateRGBSurfaceWithFormat(0, WIDTH, HEIGHT, 32, SDL_PIXELFORMAT_RGB888);
+    SDL_Renderer *renderer = target ? SDL_CreateSoftwareRenderer(target) : NULL;
+    SDL_Surface *texture = SDL_CreateRGBSurfaceWithFormat(0, 64, 64, 8, SDL_PIXELFORMAT_INDEX8);
+    if(!renderer || !texture || !texture->format->palette)
+    {
+        printf("could not make a software renderer, skipping fillTriangle and textureTriangle\n");
+        if(texture)
+            SDL_FreeSurface(texture);
+        if(target)
+            SDL_FreeSurface(target);
+        return;
+    }
+    SDL_Color palette[256];
+    int i, x, y;
+    for(i=0;i < 256;i++)
+        palette[i] = (SDL_Color){i, 255 - i, (i * 7) & 255, 255};
+    SDL_SetPaletteColors(texture->format->palette, palette, 0, 256);
+    for(y=0;y < 64;y++)
+        for(x=0;x < 64;x++)
+            ((Uint8 *)texture->pixels)[y * texture->pitch + x] = ((x / 8 + y / 8) & 1) ? x * 4 : 255 - y * 4;
+
+    colour grey = {128, 128, 128};
+    indexedFrame indexed;
+    bool hasIndexed = indexedFrameInit(&indexed, renderer, WIDTH, HEIGHT, &grey, 1, 1, false);
+    if(hasIndexed)
+        indexed.colour = INDEXED_MAP_COLOURS;
+    SDL_SetRenderDrawColor(renderer, grey.r, grey.g, grey.b, SDL_ALPHA_OPAQUE);
+
+    face f;
+    memset(&f, 0, sizeof(face));
+    f.uv1 = (vec2){1, 1}; //kept a texel in from the edges, pixels just outside the triangle read just outside these
+    f.uv2 = (vec2){62, 1};
+    f.uv3 = (vec2){1, 62};
+
+    int textured, into, size;
+    for(textured=0;textured < 2;textured++)
+        for(into=0;into < (hasIndexed ? 2 : 1);into++)
+            for(size=8;size <= 512;size *= 4)
+            {
+                int n = max(BENCH_PIXELS / (size * size / 2), 16);
+                double pixels = 0;
+                Uint64 start = SDL_GetPerformanceCounter();
+                for(i=0;i < n;i++)
+                {
+                    vec2 p1 = {(i * 7919u) % (WIDTH - size), (i * 104729u) % (HEIGHT - size)};
+                    vec2 p2 = {p1.x + size, p1.y}, p3 = {p1.x, p1.y + size};
+                    if(textured)
+                        pixels += textureTriangle(p1, p2, p3, f.uv1, f.uv2, f.uv3, renderer, texture, f.texture, NULL, into ? &indexed : NULL);
+                    else
+                        pixels += fillTriangle(p1, p2, p3, renderer, NULL, into ? &indexed : NULL);
+                }
+                double t = benchTime(start);
+                printf("%-15s %-8s %4dpx triangles: %10.0f triangles/s %8.1f Mpixels/s\n", textured ? "textureTriangle" : "fillTriangle", into ? "indexed" : "renderer", size, n / t, pixels / t / 1e6);
+            }
+
+    if(hasIndexed)
+        indexedFrameFree(&indexed);
+    SDL_DestroyRenderer(renderer);
+    SDL_FreeSurface(texture);
+    SDL_FreeSurface(target);
+}
+
+void benchQuicksort(int maxFaces) //random keys, sorted the way drawFilledFaces sorts faces by depth
+{
+    int n, i;
+    for(n=1024;n <= maxFaces;n *= 4)
+    {
+        int *list = malloc(n * sizeof(int));
+        float *keys = malloc(n * sizeof(float));
+        srand(n);
+        for(i=0;i < n;i++)
+        {
+            list[i] = i;
+            keys[i] = 10000.0 * rand() / RAND_MAX;
+        }
+        Uint64 start = SDL_GetPerformanceCounter();
+        quicksort(list, keys, 0, n-1);
+        double t = benchTime(start);
+        printf("%-24s %8d keys: %10.3f ms %8.2f Mkeys/s\n", "quicksort", n, t * 1000, n / t / 1e6);
+        free(list);
+        free(keys);
+        if(t > BENCH_MAX_SECONDS)
+            break;
+    }
+}
+
+/*
+loadMap on every kind of generated map, then buildClipVectors and clipVelocity on the rooms
+clipVelocity is tested the way the player used to move, every face against each of BENCH_RAYS moves from random points in the map
+*/
+void benchMaps(int maxFaces)
+{
+    char *kinds[3] = {"rooms", "sphere", "soup"};
+    bool done[5] = {false}; //loadMap for each kind, buildClipVectors, clipVelocity
+    int size, k, i, j;
+    for(size=1024;size <= maxFaces;size *= 4)
+        for(k=0;k < 3;k++)
+        {
+            if(done[k] && (k > 0 || (done[3] && done[4])))
+                continue;
+            generatedMap generated;
+            bool written = generateMap(&generated, kinds[k], size) && writeGeneratedMap(&generated, BENCH_MAP_FILE);
+            freeGeneratedMap(&generated);
+            if(!written)
+                return;
+
+            int nVectors, nColours, nTextures, nMeshes, nInstances;
+            vec3 *vectors;
+            faceTable faces;
+            colour *colours;
+            camera player;
+            char **textureNames;
+            mesh *meshes;
+            meshInstance *instances;
+            Uint64 start = SDL_GetPerformanceCounter();
+            loadMap(&nVectors, &nColours, &vectors, &faces, &colours, BENCH_MAP_FILE, &player, &textureNames, &nTextures, &nMeshes, &meshes, &nInstances, &instances);
+            double t = benchTime(start);
+            if(!done[k])
+                printf("%-17s %-6s %8d faces: %10.3f ms %8.1f kfaces/s\n", "loadMap", kinds[k], faces.n, t * 1000, faces.n / t / 1e3);
+            done[k] = done[k] || t > BENCH_MAX_SECONDS;
+
+            if(k == 0 && !done[3])
+            {
+                arena scratch;
+                arenaInit(&scratch, (faces.n + 1) * sizeof(int) + ARENA_ALIGN);
+                vec3 *clipVectors = malloc(max(nVectors, 1) * sizeof(vec3));
+                start = SDL_GetPerformanceCounter();
+                buildClipVectors(nVectors, vectors, &faces, clipVectors, &scratch);
+                t = benchTime(start);
+                printf("%-24s %8d faces: %10.3f ms %8.1f kfaces/s\n", "buildClipVectors", faces.n, t * 1000, faces.n / t / 1e3);
+                done[3] = t > BENCH_MAX_SECONDS;
+                free(clipVectors);
+                arenaFree(&scratch);
+            }
+
+            if(k == 0 && !done[4])
+            {
+                vec3 low = vectors[0], high = vectors[0];
+                for(i=1;i < nVectors;i++)
+                {
+                    low = (vec3){min(low.x, vectors[i].x), min(low.y, vectors[i].y), min(low.z, vectors[i].z)};
+                    high = (vec3){max(high.x, vectors[i].x), max(high.y, vectors[i].y), max(high.z, vectors[i].z)};
+                }
+                srand(size);
+                int hits = 0;
+                start = SDL_GetPerformanceCounter();
+                for(i=0;i < BENCH_RAYS;i++)
+                {
+                    camera mover = player;
+                    mover.pos = (vec3){low.x + (high.x - low.x) * rand() / RAND_MAX, low.y + (high.y - low.y) * rand() / RAND_MAX, low.z + (high.z - low.z) * rand() / RAND_MAX};
+                    mover.vel = (vec3){60.0 * rand() / RAND_MAX - 30, 60.0 * rand() / RAND_MAX - 30, 60.0 * rand() / RAND_MAX - 30};
+                    for(j=0;j < faces.n;j++)
+                        hits += clipVelocity(&mover, &faces, j, vectors);
+                }
+                t = benchTime(start);
+                printf("%-24s %8d faces: %10.3f ms %8.2f Mtests/s (%d hits)\n", "clipVelocity", faces.n, t * 1000, (double)BENCH_RAYS * faces.n / t / 1e6, hits);
+                done[4] = t > BENCH_MAX_SECONDS;
+            }
+
+            free(vectors);
+            faceTableFree(&faces);
+            free(colours);
+            free(textureNames);
+            free(meshes);
+            free(instances);
+        }
+    remove(BENCH_MAP_FILE);
+}
+
+/*
+reference implementation of the player's collision from before the collision table, only -bench calls it now
+collisionTest is the same test, this is kept so the old per face rate can be compared with the table's
+*/
+bool clipVelocity(camera *player, faceTable *faces, int i, vec3 *points) //only reads the hot arrays of face i
+{
+    float e = 0.001;
+    vec3 norm = faceNormal(faces, i);
+    int *p = &faces->indices[i*3];
+    if(dot(norm, player->vel) >= 0)
+        return false;
+    float d = (faces->planes[i*4 + 3] - dot(player->pos, norm)) / dot(player->vel, norm);
+
+    if(d >= 1 || d < -e)
+        return false;
+
+    vec3 intersect = add(player->pos, mul(player->vel, d));
+    vec3 t2 = sub(points[p[1]], points[p[0]]);
+    vec3 t3 = sub(points[p[2]], points[p[0]]);
+    vec3 w = sub(intersect, points[p[0]]);
+
+    float bot = dot(t2, t3);
+    bot *= bot;
+    bot -= dot(t2, t2) * dot(t3, t3);
+
+    float u = ((dot(t2, t3) * dot(w, t2)) - (dot(t2, t2) * dot(w, t3))) / bot;
+    float v = ((dot(t2, t3) * dot(w, t3)) - (dot(t3, t3) * dot(w, t2))) / bot;
+
+    if(v < -e || v > 1.0 + e || u < -e || u > 1.0 + e || u + v > 1.0 + e)
+        return false;
+
+    player->vel = sub(player->vel, mul(norm, dot(norm, mul(player->vel, 1.0 - d)) -e));
+    return true;
+}
+
+/*
+drawFilledFaces on generated maps from BENCH_FRONT_END_FACES up, on this thread alone and then split over the job pool
+the frames go into a software renderer, so the time includes the raster, but that stays about the same as the maps grow and the culling, keys and projection don't
+*/
+void benchDrawFaces(int maxFaces)
+{
+    WIDTH = BENCH_WIDTH;
+    HEIGHT = BENCH_HEIGHT;
+    ENTITY_COUNT = 0;
+    SDL_Surface *target = SDL_CreateRGBSurfaceWithFormat(0, WIDTH, HEIGHT, 32, SDL_PIXELFORMAT_RGB888);
+    SDL_Renderer *renderer = target ? SDL_CreateSoftwareRenderer(target) : NULL;
+    if(!renderer)
+    {
+        printf("could not make a software renderer, skipping drawFilledFaces\n");
+        if(target)
+            SDL_FreeSurface(target);
+        return;
+    }
+    arena frameArena;
+    arenaInit(&frameArena, FRAME_ARENA_SIZE);
+    jobPool jobThreads;
+    jobPool *jobs = jobPoolInit(&jobThreads, defaultJobThreads(0)) && jobThreads.nThreads > 1 ? &jobThreads : NULL;
+    if(!jobs)
+        printf("one core, drawFilledFaces is only timed on one thread\n");
+
+    char *kinds[3] = {"rooms", "sphere", "soup"};
+    bool done[3] = {false};
+    int size, k, threaded, i;
+    for(size=min(BENCH_FRONT_END_FACES, maxFaces);size <= maxFaces;size *= 4)
+        for(k=0;k < 3;k++)
+        {
+            if(done[k])
+                continue;
+            generatedMap generated;
+            bool written = generateMap(&generated, kinds[k], size) && writeGeneratedMap(&generated, BENCH_MAP_FILE);
+            freeGeneratedMap(&generated);
+            if(!written)
+                break;
+
+            mapLoader map;
+            startMapLoad(&map, BENCH_MAP_FILE);
+            finishMapLoad(&map);
+            for(threaded=0;threaded < (jobs ? 2 : 1);threaded++)
+            {
+                renderStats stats;
+                memset(&stats, 0, sizeof(renderStats));
+                Uint64 start = SDL_GetPerformanceCounter();
+                for(i=0;i < BENCH_FRAMES;i++)
+                {
+                    camera view = map.player;
+                    view.yaw = 2 * M_PI * i / BENCH_FRAMES;
+                    arenaReset(&frameArena);
+                    SDL_SetRenderDrawColor(renderer, 0,0,0, SDL_ALPHA_OPAQUE);
+                    SDL_RenderClear(renderer);
+                    drawFilledFaces(&map.faces, view, map.vectors, renderer, map.colours, map.textures, map.allMeshes, map.instances, map.nInstances, &frameArena, NULL, threaded ? jobs : NULL, &stats);
+                }
+                double t = benchTime(start);
+                printf("%-17s %-6s %8d faces: %10.3f ms/frame %2d threads (%d drawn a frame)\n", "drawFilledFaces", kinds[k], map.faces.n, t * 1000 / BENCH_FRAMES, threaded ? jobs->nThreads : 1, stats.facesDrawn / BENCH_FRAMES);
+                done[k] = done[k] || t / BENCH_FRAMES > BENCH_MAX_SECONDS / 8;
+            }
+            freeMap(&map);
+        }
+    remove(BENCH_MAP_FILE);
+    jobPoolFree(&jobThreads);
+    arenaFree(&frameArena);
+    SDL_DestroyRenderer(renderer);
+    SDL_FreeSurface(target);
+}
+
+/*
+-regress, draws each case off screen and compares it with a reference image, for checking a new drawing path gives the same pictures as the old one
+each line of the case file is "map,x,y,z,pitch,yaw,reference.bmp", drawn at REGRESS_WIDTH x REGRESS_HEIGHT with settings pinned here rather than read from settings.txt
+every case is drawn down each combination of span buffer, indexed framebuffer and one or REGRESS_JOB_THREADS threads, and each of them is compared with the same reference
+a missing reference is a failure, with update every reference is written from the first path instead, for when a change to the pictures is meant, and the others are still compared with it
+on a failure the frame is written next to the reference as _<path>_out.bmp, and _<path>_diff.bmp shows the pixels that were off in red over a dimmed reference
+returns 1 if any case failed on any path
+*/
+int runRegression(char *caseFile, int tolerance, bool update)
+{
+    struct
+    {
+        char *name;
+        int spanBuffer, indexed, threaded;
+    } paths[] = {{"plain", 0, 0, 0}, {"threaded", 0, 0, 1}, {"span", 1, 0, 0}, {"span_threaded", 1, 0, 1},
+                 {"indexed", 0, 1, 0}, {"indexed_threaded", 0, 1, 1}, {"indexed_span", 1, 1, 0}, {"indexed_span_threaded", 1, 1, 1}};
+    int nPaths = sizeof(paths) / sizeof(paths[0]);
+
+    WINDOW_WIDTH = REGRESS_WIDTH;
+    WINDOW_HEIGHT = REGRESS_HEIGHT;
+    FRUSTUM_WIDTH = REGRESS_FRUSTUM_WIDTH;
+    FRUSTUM_NEAR_LENGTH = REGRESS_FRUSTUM_NEAR_LENGTH;
+    ENTITY_COUNT = 0; //entities move, so they'd never match
+    DRAW_EDGES = false; //the span buffer never draws edges, so every path is compared without them
+    OCCLUSION_CULL = true;
+    MERGE_FACES = true;
+    OVERDRAW_VIEW = false;
+    setRenderScale(1.0);
+    FILE *cases = fopen(caseFile, "r");
+    SDL_Surface *target = SDL_CreateRGBSurfaceWithFormat(0, WIDTH, HEIGHT, 32, SDL_PIXELFORMAT_RGB888);
+    SDL_Surface *frame = SDL_CreateRGBSurfaceWithFormat(0, WIDTH, HEIGHT, 32, SDL_PIXELFORMAT_RGB888);
+    SDL_Surface *diff = SDL_CreateRGBSurfaceWithFormat(0, WIDTH, HEIGHT, 32, SDL_PIXELFORMAT_RGB888);
+    SDL_Renderer *renderer = target ? SDL_CreateSoftwareRenderer(target) : NULL;
+    if(!cases || !frame || !diff || !renderer)
+    {
+        printf(cases ? "could not make a software renderer\n" : "could not open %s\n", caseFile);
+        return 1;
+    }
+    arena frameArena;
+    arenaInit(&frameArena, FRAME_ARENA_SIZE);
+    jobPool jobThreads;
+    if(!jobPoolInit(&jobThreads, REGRESS_JOB_THREADS) || jobThreads.nThreads < 2)
+        printf("could not start the job threads, the threaded paths are drawn on one\n");
+
+    mapLoader map;
+    char mapName[64] = "", nextMap[64], reference[128];
+    indexedFrame indexedBuffer;
+    indexedFrame *indexed = NULL;
+    camera player;
+    memset(&player, 0, sizeof(camera));
+    int nCases = 0, nFailed = 0, nWritten = 0;
+    while(fscanf(cases, " %63[^,],%f,%f,%f,%f,%f,%127[^\n]\n", nextMap, &player.pos.x, &player.pos.y, &player.pos.z, &player.pitch, &player.yaw, reference) == 7)
+    {
+        if(strcmp(nextMap, mapName) != 0) //cases for the same map are usually together, it's only loaded again when it changes
+        {
+            if(mapName[0])
+            {
+                if(indexed)
+                    indexedFrameFree(indexed);
+                freeMap(&map);
+            }
+            strcpy(mapName, nextMap);
+            startMapLoad(&map, mapName);
+            finishMapLoad(&map);
+            indexed = NULL;
+            if(indexedFrameInit(&indexedBuffer, renderer, WIDTH, HEIGHT, map.colours, map.nColours, map.nTextures, false))
+                indexed = &indexedBuffer;
+        }
+        nCases++;
+
+        if(update)
+        {
+            SPAN_BUFFER = paths[0].spanBuffer;
+            drawRegressionCase(&map, player, renderer, paths[0].indexed ? indexed : NULL, paths[0].threaded ? &jobThreads : NULL, &frameArena);
+            SDL_RenderReadPixels(renderer, NULL, SDL_PIXELFORMAT_RGB888, frame->pixels, frame->pitch);
+            if(SDL_SaveBMP(frame, reference) == 0)
+            {
+                printf("wrote %s\n", reference);
+                nWritten++;
+            }
+        }
+        SDL_Surface *loaded = SDL_LoadBMP(reference);
+        SDL_Surface *expected = loaded ? SDL_ConvertSurfaceFormat(loaded, SDL_PIXELFORMAT_RGB888, 0) : NULL;
+        if(loaded)
+            SDL_FreeSurface(loaded);
+        if(!expected)
+        {
+            printf(update ? "FAIL %s: couldn't be written\n" : "FAIL %s: no reference, -update writes it\n", reference);
+            nFailed++;
+            continue;
+        }
+
+        int path, nPathsFailed = 0;
+        for(path=0;path < nPaths;path++)
+        {
+            if(paths[path].indexed && !indexed)
+            {
+                printf("FAIL %s on %s: the indexed framebuffer couldn't be made\n", reference, paths[path].name);
+                nPathsFailed++;
+                continue;
+            }
+            SPAN_BUFFER = paths[path].spanBuffer;
+            drawRegressionCase(&map, player, renderer, paths[path].indexed ? indexed : NULL, paths[path].threaded ? &jobThreads : NULL, &frameArena);
+            SDL_RenderReadPixels(renderer, NULL, SDL_PIXELFORMAT_RGB888, frame->pixels, frame->pitch);
+
+            int maxDifference = 0;
+            int nDifferent = compareImages(frame, expected, tolerance, diff, &maxDifference, paths[path].indexed ? indexed : NULL);
+            if(nDifferent == 0)
+                continue;
+            nPathsFailed++;
+            if(nDifferent < 0)
+                printf("FAIL %s on %s: reference is %dx%d, frame is %dx%d\n", reference, paths[path].name, expected->w, expected->h, WIDTH, HEIGHT);
+            else
+                printf("FAIL %s on %s: %d pixels off by more than %d, worst by %d\n", reference, paths[path].name, nDifferent, tolerance, maxDifference);
+
+            char name[160];
+            int length = strlen(reference);
+            if(length > 4 && strcmp(reference + length - 4, ".bmp") == 0)
+                length -= 4;
+            snprintf(name, sizeof(name), "%.*s_%s_out.bmp", length, reference, paths[path].name);
+            SDL_SaveBMP(frame, name);
+            if(nDifferent > 0)
+            {
+                snprintf(name, sizeof(name), "%.*s_%s_diff.bmp", length, reference, paths[path].name);
+                SDL_SaveBMP(diff, name);
+            }
+        }
+        if(nPathsFailed == 0)
+            printf("pass %s\n", reference);
+        nFailed += nPathsFailed;
+        SDL_FreeSurface(expected);
+    }
+    printf("%d cases on %d paths, %d failed, %d references written\n", nCases, nPaths, nFailed, nWritten);
+
+    if(mapName[0])
+    {
+        if(indexed)
+            indexedFrameFree(indexed);
+        freeMap(&map);
+    }
+    fclose(cases);
+    jobPoolFree(&jobThreads);
+    arenaFree(&frameArena);
+    SDL_DestroyRenderer(renderer);
+    SDL_FreeSurface(target);
+    SDL_FreeSurface(frame);
+    SDL_FreeSurface(diff);
+    return nFailed > 0;
+}
+
+void drawRegressionCase(mapLoader *map, camera player, SDL_Renderer *renderer, indexedFrame *indexed, jobPool *jobs, arena *frameArena) //the same steps main goes through to draw a frame, minus presenting it
+{
+    renderStats stats;
+    memset(&stats, 0, sizeof(renderStats));
+    arenaReset(frameArena);
+    SDL_SetRenderDrawColor(renderer, 0,0,0, SDL_ALPHA_OPAQUE);
+    SDL_RenderClear(renderer);
+    if(indexed)
+        memset(indexed->pixels, INDEXED_BLACK, indexed->width * HEIGHT);
+    drawFilledFaces(&map->faces, player, map->vectors, renderer, map->colours, map->textures, map->allMeshes, map->instances, map->nInstances, frameArena, indexed, jobs, &stats);
+    if(indexed)
+    {
+        SDL_Rect area = {0, 0, WIDTH, HEIGHT};
+        resolveIndexedFrame(indexed, WIDTH, HEIGHT);
+        SDL_RenderCopy(renderer, indexed->texture, &area, &area);
+    }
+}
+
+/*
+all RGB888, returns how many pixels are further than tolerance from the reference in any channel, or -1 if the sizes don't match
+an image drawn through indexed is also let off where the reference has a colour its palette had no room for, as long as it's the closest entry the palette does have
+*/
+int compareImages(SDL_Surface *image, SDL_Surface *reference, int tolerance, SDL_Surface *diff, int *maxDifference, indexedFrame *indexed)
+{
+    if(image->w != reference->w || image->h != reference->h)
+        return -1;
+    int x, y, nDifferent = 0;
+    *maxDifference = 0;
+    for(y=0;y < image->h;y++)
+    {
+        Uint32 *a = (Uint32 *)((Uint8 *)image->pixels + y * image->pitch);
+        Uint32 *b = (Uint32 *)((Uint8 *)reference->pixels + y * reference->pitch);
+        Uint32 *d = (Uint32 *)((Uint8 *)diff->pixels + y * diff->pitch);
+        for(x=0;x < image->w;x++)
+        {
+            int difference = colourDifference(a[x], b[x]);
+            if(difference > tolerance && indexed)
+                difference = colourDifference(a[x], indexed->palette[nearestPaletteEntry(indexed->palette, indexed->nPalette, b[x] & 0xffffff)]);
+            *maxDifference = max(*maxDifference, difference);
+            if(difference > tolerance)
+            {
+                nDifferent++;
+                d[x] = 0xff0000;
+            }
+            else
+                d[x] = (b[x] >> 2) & 0x3f3f3f;
+        }
+    }
+    return nDifferent;
+}
+
+int colourDifference(Uint32 a, Uint32 b) //largest difference between a channel of two RGB888 colours
+{
+    int c, difference = 0;
+    for(c=0;c < 24;c += 8)
+        difference = max(difference, abs((int)((a >> c) & 255) - (int)((b >> c) & 255)));
+    return difference;
+}
+
+bool faceTableInit(faceTable *t, int n)
+{
+    t->n = n;
+    t->indices = (int *)malloc(max(n, 1) * 3 * sizeof(int));
+    t->planes = (float *)malloc(max(n, 1) * 4 * sizeof(float));
+    t->flags = (int *)malloc(max(n, 1) * sizeof(int));
+    t->occluderPair = (int *)malloc(max(n, 1) * sizeof(int));
+    t->texture = (int *)malloc(max(n, 1) * sizeof(int));
+    t->type = (int *)malloc(max(n, 1) * sizeof(int));
+    t->uvs = (vec2 *)malloc(max(n, 1) * 3 * sizeof(vec2));
+    t->polygonStart = NULL;
+    t->polygonPoints = NULL;
+    t->nPolygons = 0;
+    t->nClusters = 0;
+    t->clusters = NULL;
+    t->clusterFaces = NULL;
+    return t->indices && t->planes && t->flags && t->occluderPair && t->texture && t->type && t->uvs;
+}
+
+bool faceTableReserve(faceTable *t, int capacity) //makes room for capacity faces, the first t->n are kept
+{
+    int *indices = (int *)realloc(t->indices, capacity * 3 * sizeof(int));
+    t->indices = indices ? indices : t->indices;
+    float *planes = (float *)realloc(t->planes, capacity * 4 * sizeof(float));
+    t->planes = planes ? planes : t->planes;
+    int *flags = (int *)realloc(t->flags, capacity * sizeof(int));
+    t->flags = flags ? flags : t->flags;
+    int *occluderPair = (int *)realloc(t->occluderPair, capacity * sizeof(int));
+    t->occluderPair = occluderPair ? occluderPair : t->occluderPair;
+    int *texture = (int *)realloc(t->texture, capacity * sizeof(int));
+    t->texture = texture ? texture : t->texture;
+    int *type = (int *)realloc(t->type, capacity * sizeof(int));
+    t->type = type ? type : t->type;
+    vec2 *uvs = (vec2 *)realloc(t->uvs, capacity * 3 * sizeof(vec2));
+    t->uvs = uvs ? uvs : t->uvs;
+    return indices && planes && flags && occluderPair && texture && type && uvs;
+}
+
+void faceTableFree(faceTable *t)
+{
+    free(t->indices);
+    free(t->planes);
+    free(t->flags);
+    free(t->occluderPair);
+    free(t->texture);
+    free(t->type);
+    free(t->uvs);
+    free(t->polygonStart);
+    free(t->polygonPoints);
+    free(t->clusters);
+    free(t->clusterFaces);
+    t->n = 0;
+    t->nPolygons = 0;
+    t->nClusters = 0;
+}
+
+void setFace(faceTable *t, int i, face f, vec3 *vectors) //splits a face read from the map into the table, vectors are the ones its indexes point into
+{
+    t->indices[i*3] = f.p1;
+    t->indices[i*3 + 1] = f.p2;
+    t->indices[i*3 + 2] = f.p3;
+    t->planes[i*4] = f.norm.x;
+    t->planes[i*4 + 1] = f.norm.y;
+    t->planes[i*4 + 2] = f.norm.z;
+    t->planes[i*4 + 3] = dot(vectors[f.p1], f.norm);
+    t->flags[i] = f.flags;
+    t->occluderPair[i] = -1;
+    t->texture[i] = f.texture;
+    t->type[i] = f.type;
+    t->uvs[i*3] = f.uv1;
+    t->uvs[i*3 + 1] = f.uv2;
+    t->uvs[i*3 + 2] = f.uv3;
+}
+
+face getFace(faceTable *t, int i) //puts face i back together for drawing, mid isn't kept so it's left at zero
+{
+    face f = {.p1 = t->indices[i*3], .p2 = t->indices[i*3 + 1], .p3 = t->indices[i*3 + 2], .texture = t->texture[i], .type = t->type[i], .flags = t->flags[i],
+              .norm = faceNormal(t, i), .uv1 = t->uvs[i*3], .uv2 = t->uvs[i*3 + 1], .uv3 = t->uvs[i*3 + 2]};
+    return f;
+}
+
+vec3 faceNormal(faceTable *t, int i)
+{
+    vec3 norm = {t->planes[i*4], t->planes[i*4 + 1], t->planes[i*4 + 2]};
+    return norm;
+}
+
+/*
+faces are sorted by which way their normal mostly points, then by where they are (interleaving the bits of their grid cell so nearby cells sort together)
+clusters are then cut from runs of that order, starting a new one when the direction changes, the cluster is full or a normal strays too far
+only faces with a polygon are clustered, the ones merged into them are drawn as part of it
+*/
+void buildFaceClusters(faceTable *t, vec3 *vectors, int nVectors)
+{
+    t->nClusters = 0;
+    t->clusters = (faceCluster *)malloc(max(t->n, 1) * sizeof(faceCluster));
+    t->clusterFaces = (int *)malloc(max(t->n, 1) * sizeof(int));
+    float *key = (float *)malloc(max(t->n, 1) * sizeof(float));
+    if(!t->clusters || !t->clusterFaces || !key || t->nPolygons == 0 || nVectors == 0)
+    {
+        free(key);
+        return;
+    }
+
+    vec3 low = vectors[0], high = vectors[0];
+    int i, j;
+    for(i=1;i < nVectors;i++)
+    {
+        low.x = min(low.x, vectors[i].x); high.x = max(high.x, vectors[i].x);
+        low.y = min(low.y, vectors[i].y); high.y = max(high.y, vectors[i].y);
+        low.z = min(low.z, vectors[i].z); high.z = max(high.z, vectors[i].z);
+    }
+    vec3 size = {max(high.x - low.x, 1), max(high.y - low.y, 1), max(high.z - low.z, 1)};
+
+    int nClustered = 0;
+    for(i=0;i < t->n;i++)
+    {
+        int *p, nPoints = facePolygon(t, i, &p);
+        if(nPoints == 0)
+            continue;
+        vec3 n = faceNormal(t, i);
+        vec3 mid = {0, 0, 0};
+        for(j=0;j < nPoints;j++)
+            mid = add(mid, vectors[p[j]]);
+        mid = mul(mid, 1.0 / nPoints);
+        int direction = fabs(n.x) >= fabs(n.y) && fabs(n.x) >= fabs(n.z) ? (n.x < 0) : fabs(n.y) >= fabs(n.z) ? 2 + (n.y < 0) : 4 + (n.z < 0);
+        int cell[3] = {clamp((mid.x - low.x) / size.x * CLUSTER_GRID, 0, CLUSTER_GRID - 1), clamp((mid.y - low.y) / size.y * CLUSTER_GRID, 0, CLUSTER_GRID - 1),
+                       clamp((mid.z - low.z) / size.z * CLUSTER_GRID, 0, CLUSTER_GRID - 1)};
+        int code = 0, bit;
+        for(bit=0;(1 << bit) < CLUSTER_GRID;bit++)
+            for(j=0;j < 3;j++)
+                code |= ((cell[j] >> bit) & 1) << (bit*3 + j);
+        key[i] = direction * CLUSTER_GRID * CLUSTER_GRID * CLUSTER_GRID + code;
+        t->clusterFaces[nClustered++] = i;
+    }
+    quicksort(t->clusterFaces, key, 0, nClustered - 1);
+
+    for(i=0;i < nClustered;)
+    {
+        faceCluster *c = &t->clusters[t->nClusters++];
+        c->first = i;
+        vec3 first = faceNormal(t, t->clusterFaces[i]);
+        float direction = floor(key[t->clusterFaces[i]] / (CLUSTER_GRID * CLUSTER_GRID * CLUSTER_GRID));
+        for(i++;i < nClustered && i - c->first < CLUSTER_MAX_FACES;i++)
+            if(floor(key[t->clusterFaces[i]] / (CLUSTER_GRID * CLUSTER_GRID * CLUSTER_GRID)) != direction || dot(faceNormal(t, t->clusterFaces[i]), first) < CLUSTER_MIN_COS)
+                break;
+        c->n = i - c->first;
+
+        vec3 cLow, cHigh, sum = {0, 0, 0};
+        cLow = cHigh = vectors[t->indices[t->clusterFaces[c->first]*3]];
+        for(j=c->first;j < i;j++)
+        {
+            int k, *p, nPoints = facePolygon(t, t->clusterFaces[j], &p);
+            for(k=0;k < nPoints;k++)
+            {
+                cLow.x = min(cLow.x, vectors[p[k]].x); cHigh.x = max(cHigh.x, vectors[p[k]].x);
+                cLow.y = min(cLow.y, vectors[p[k]].y); cHigh.y = max(cHigh.y, vectors[p[k]].y);
+                cLow.z = min(cLow.z, vectors[p[k]].z); cHigh.z = max(cHigh.z, vectors[p[k]].z);
+            }
+            sum = add(sum, faceNormal(t, t->clusterFaces[j]));
+        }
+        c->centre = mul(add(cLow, cHigh), 0.5);
+        c->axis = unit(sum);
+        c->radius = 0;
+        float minDot = 1;
+        for(j=c->first;j < i;j++)
+        {
+            int k, *p, nPoints = facePolygon(t, t->clusterFaces[j], &p);
+            for(k=0;k < nPoints;k++)
+                c->radius = max(c->radius, length(sub(vectors[p[k]], c->centre)));
+            minDot = min(minDot, dot(faceNormal(t, t->clusterFaces[j]), c->axis));
+        }
+        c->cutoff = minDot > 0.1 ? sqrt(1 - minDot * minDot) : 2;
+    }
+    free(key);
+}
+
+/*
+maps are mostly quads split into two triangles, and the texels along the split aren't covered by either half on its own, so they'd leave a line of holes in the occlusion buffer
+each face is paired with a neighbour in the same plane if the two of them make a convex quad, and the quad is drawn instead
+faces that were merged into polygons are left out, their polygon is drawn whole
+*/
+void pairOccluderFaces(faceTable *t, vec3 *vectors, int nVectors)
+{
+    int *vertexStart, *vertexFaceList;
+    if(!vertexFaces(t, nVectors, &vertexStart, &vertexFaceList))
+        return;
+    int i, j, k;
+    for(i=0;i < t->n;i++)
+    {
+        int *p = &t->indices[i*3];
+        vec3 n = faceNormal(t, i);
+        if(!polygonIsFace(t, i))
+            continue;
+        for(k=0;k < 3 && t->occluderPair[i] < 0;k++)
+            for(j=vertexStart[p[k]];j < vertexStart[p[k] + 1] && t->occluderPair[i] < 0;j++)
+            {
+                int other = vertexFaceList[j];
+                int *q = &t->indices[other*3];
+                if(other == i || t->occluderPair[other] >= 0 || !polygonIsFace(t, other) || dot(faceNormal(t, other), n) < 0.999 || fabs(t->planes[other*4 + 3] - t->planes[i*4 + 3]) > COPLANAR_EPSILON)
+                    continue;
+                int shared = 0, m;
+                for(m=0;m < 3;m++)
+                    shared += q[m] == p[k] || q[m] == p[(k+1)%3];
+                if(shared != 2)
+                    continue;
+                t->occluderPair[i] = other;
+                t->occluderPair[other] = i;
+                int polygon[4];
+                occluderPolygon(t, i, polygon);
+                bool left = false, right = false; //every corner of a convex quad turns the same way
+                for(m=0;m < 4;m++)
+                {
+                    float turn = dot(cross(sub(vectors[polygon[(m+1)%4]], vectors[polygon[m]]), sub(vectors[polygon[(m+2)%4]], vectors[polygon[(m+1)%4]])), n);
+                    left |= turn > COPLANAR_EPSILON;
+                    right |= turn < -COPLANAR_EPSILON;
+                }
+                if(left && right)
+                    t->occluderPair[i] = t->occluderPair[other] = -1;
+            }
+    }
+    free(vertexStart);
+    free(vertexFaceList);
+}
+
+bool vertexFaces(faceTable *t, int nVectors, int **start, int **list) //faces touching each vertex v are (*list)[(*start)[v]] to (*list)[(*start)[v + 1] - 1], both arrays are the caller's to free
+{
+    int *vertexStart = (int *)calloc(nVectors + 1, sizeof(int));
+    int *vertexFill = (int *)malloc(max(nVectors, 1) * sizeof(int));
+    int *vertexFaceList = (int *)malloc(max(t->n, 1) * 3 * sizeof(int));
+    if(!vertexStart || !vertexFill || !vertexFaceList)
+    {
+        free(vertexStart);
+        free(vertexFill);
+        free(vertexFaceList);
+        return false;
+    }
+    int i;
+    for(i=0;i < t->n * 3;i++)
+        vertexStart[t->indices[i] + 1]++;
+    for(i=0;i < nVectors;i++)
+    {
+        vertexStart[i + 1] += vertexStart[i];
+        vertexFill[i] = vertexStart[i];
+    }
+    for(i=0;i < t->n * 3;i++)
+        vertexFaceList[vertexFill[t->indices[i]]++] = i / 3;
+    free(vertexFill);
+    *start = vertexStart;
+    *list = vertexFaceList;
+    return true;
+}
+
+int weldVectors(vec3 *vectors, int nVectors, faceTable *t) //makes vertices in the same WELD_EPSILON grid cell one, moving the ones kept to the front of vectors, returns how many are kept
+{
+    int tableSize = 1;
+    while(tableSize < nVectors * 2)
+        tableSize *= 2;
+    int *table = (int *)malloc(tableSize * sizeof(int)); //kept vertex in each slot, -1 for empty ones
+    int *remap = (int *)malloc(max(nVectors, 1) * sizeof(int));
+    vec3 *cells = (vec3 *)malloc(max(nVectors, 1) * sizeof(vec3));
+    if(!table || !remap || !cells)
+    {
+        free(table);
+        free(remap);
+        free(cells);
+        return nVectors;
+    }
+    int i, nKept = 0;
+    for(i=0;i < tableSize;i++)
+        table[i] = -1;
+    for(i=0;i < nVectors;i++)
+    {
+        vec3 cell = {floorf(vectors[i].x / WELD_EPSILON + 0.5f), floorf(vectors[i].y / WELD_EPSILON + 0.5f), floorf(vectors[i].z / WELD_EPSILON + 0.5f)};
+        int slot = ((unsigned)(int)cell.x * 73856093u ^ (unsigned)(int)cell.y * 19349663u ^ (unsigned)(int)cell.z * 83492791u) & (tableSize - 1);
+        while(table[slot] != -1 && (cells[table[slot]].x != cell.x || cells[table[slot]].y != cell.y || cells[table[slot]].z != cell.z))
+            slot = (slot + 1) & (tableSize - 1);
+        if(table[slot] == -1) //nKept is never more than i, so the vertex can be moved down without overwriting one that hasn't been looked at
+        {
+            table[slot] = nKept;
+            cells[nKept] = cell;
+            vectors[nKept] = vectors[i];
+            nKept++;
+        }
+        remap[i] = table[slot];
+    }
+    for(i=0;i < t->n * 3;i++)
+        t->indices[i] = remap[t->indices[i]];
+    free(table);
+    free(remap);
+    free(cells);
+    return nKept;
+}
+
+void removeDegenerateFaces(faceTable *t, vec3 *vectors) //drops faces with two corners welded together or too little area to cover a pixel, before anything else is built from the table
+{
+    int i, nKept = 0;
+    for(i=0;i < t->n;i++)
+    {
+        int *p = &t->indices[i*3];
+        if(p[0] == p[1] || p[1] == p[2] || p[2] == p[0] || length(cross(sub(vectors[p[1]], vectors[p[0]]), sub(vectors[p[2]], vectors[p[0]]))) < DEGENERATE_AREA * 2)
+            continue;
+        memmove(&t->indices[nKept*3], p, 3 * sizeof(int));
+        memmove(&t->planes[nKept*4], &t->planes[i*4], 4 * sizeof(float));
+        memmove(&t->uvs[nKept*3], &t->uvs[i*3], 3 * sizeof(vec2));
+        t->flags[nKept] = t->flags[i];
+        t->occluderPair[nKept] = t->occluderPair[i];
+        t->texture[nKept] = t->texture[i];
+        t->type[nKept] = t->type[i];
+        nKept++;
+    }
+    t->n = nKept;
+}
+
+/*
+a corner of one face in the middle of another face's edge is a T-junction, the two faces don't share the points their edges are filled between so pixels along it can be missed
+the face with the long edge is split in two at the corner, until no face has a vertex in the middle of an edge, merging joins the pieces back together afterwards
+*/
+void splitTJunctions(faceTable *t, vec3 *vectors, int nVectors)
+{
+    int *sortedX = (int *)malloc(max(nVectors, 1) * sizeof(int));
+    float *keys = (float *)malloc(max(nVectors, 1) * sizeof(float));
+    int capacity = t->n;
+    int i, k;
+    for(i=0;i < nVectors && sortedX && keys;i++)
+    {
+        sortedX[i] = i;
+        keys[i] = vectors[i].x;
+    }
+    if(sortedX && keys && nVectors > 0)
+        quicksort(sortedX, keys, 0, nVectors - 1);
+    for(i=0;i < t->n && sortedX && keys;i++)
+        for(k=0;k < 3;k++) //a face that's split is checked again from its first edge, the new half is checked when the loop gets to it
+        {
+            int *p = &t->indices[i*3];
+            int a = p[k], b = p[(k+1)%3];
+            int v = vertexOnEdge(vectors, sortedX, keys, nVectors, a, b);
+            if(v < 0)
+                continue;
+            if(t->n == capacity && !faceTableReserve(t, capacity = capacity * 2 + 16))
+                break;
+            p = &t->indices[i*3];
+            int j = t->n++;
+            float along = length(sub(vectors[v], vectors[a])) / length(sub(vectors[b], vectors[a]));
+            vec2 uv = add2(t->uvs[i*3 + k], mul2(sub2(t->uvs[i*3 + (k+1)%3], t->uvs[i*3 + k]), along));
+            memcpy(&t->indices[j*3], p, 3 * sizeof(int));
+            memcpy(&t->planes[j*4], &t->planes[i*4], 4 * sizeof(float));
+            memcpy(&t->uvs[j*3], &t->uvs[i*3], 3 * sizeof(vec2));
+            t->flags[j] = t->flags[i];
+            t->occluderPair[j] = -1;
+            t->texture[j] = t->texture[i];
+            t->type[j] = t->type[i];
+            p[(k+1)%3] = v; //this face keeps a to v, the new one v to b, both in the same winding
+            t->uvs[i*3 + (k+1)%3] = uv;
+            t->indices[j*3 + k] = v;
+            t->uvs[j*3 + k] = uv;
+            k = -1;
+        }
+    free(sortedX);
+    free(keys);
+}
+
+int vertexOnEdge(vec3 *vectors, int *sortedX, float *keys, int nVectors, int a, int b) //a vertex within WELD_EPSILON of the edge a to b, away from its ends, -1 if there isn't one
+{
+    vec3 lo = {min(vectors[a].x, vectors[b].x) - WELD_EPSILON, min(vectors[a].y, vectors[b].y) - WELD_EPSILON, min(vectors[a].z, vectors[b].z) - WELD_EPSILON};
+    vec3 hi = {max(vectors[a].x, vectors[b].x) + WELD_EPSILON, max(vectors[a].y, vectors[b].y) + WELD_EPSILON, max(vectors[a].z, vectors[b].z) + WELD_EPSILON};
+    vec3 edge = sub(vectors[b], vectors[a]);
+    float edgeLength = length(edge);
+    int first = 0, last = nVectors, i;
+    while(first < last) //first vertex at or past the low end of the edge in x
+    {
+        int mid = (first + last) / 2;
+        if(keys[sortedX[mid]] < lo.x)
+            first = mid + 1;
+        else
+            last = mid;
+    }
+    for(i=first;i < nVectors && keys[sortedX[i]] <= hi.x;i++)
+    {
+        int v = sortedX[i];
+        vec3 q = vectors[v];
+        if(v == a || v == b || q.y < lo.y || q.y > hi.y || q.z < lo.z || q.z > hi.z)
+            continue;
+        float along = dot(sub(q, vectors[a]), edge) / edgeLength;
+        if(along > WELD_EPSILON && along < edgeLength - WELD_EPSILON && length(sub(sub(q, vectors[a]), mul(edge, along / edgeLength))) < WELD_EPSILON)
+            return v;
+    }
+    return -1;
+}
+
+/*
+floors and walls are made of many triangles, which would each be culled, sorted, clipped and filled on their own
+flat faces are joined with neighbours sharing an edge if they're in the same plane with the same colour and what they make is still convex, up to MAX_POLYGON_POINTS corners
+the polygon goes on the lowest face of the ones joined, the others keep their triangles for collision but aren't drawn themselves
+textured faces are left alone, their texture coordinates are worked out a triangle at a time
+normals come from the face type rather than the order of the corners, so every triangle is turned to wind the same way around its normal before they're joined
+*/
+void mergeFacePolygons(faceTable *t, vec3 *vectors, int nVectors)
+{
+    int i, j, k;
+    int *loops = (int *)malloc(max(t->n, 1) * MAX_POLYGON_POINTS * sizeof(int)); //polygon of each face that's still a lead, loops[i * MAX_POLYGON_POINTS] on
+    int *nLoop = (int *)malloc(max(t->n, 1) * sizeof(int));
+    int *lead = (int *)malloc(max(t->n, 1) * sizeof(int)); //face this one was merged into, followed until a face leads itself
+    t->polygonStart = (int *)malloc((t->n + 1) * sizeof(int));
+    t->polygonPoints = (int *)malloc(max(t->n, 1) * 3 * sizeof(int)); //two faces merging always loses two corners, so there's never more than this
+    if(!loops || !nLoop || !lead || !t->polygonStart || !t->polygonPoints)
+    {
+        free(loops);
+        free(nLoop);
+        free(lead);
+        t->nPolygons = 0;
+        return;
+    }
+    for(i=0;i < t->n;i++)
+    {
+        int *p = &t->indices[i*3], *loop = &loops[i * MAX_POLYGON_POINTS];
+        bool backwards = cornerTurn(vectors[p[0]], vectors[p[1]], vectors[p[2]], faceNormal(t, i)) < 0;
+        loop[0] = p[0];
+        loop[1] = p[backwards ? 2 : 1];
+        loop[2] = p[backwards ? 1 : 2];
+        nLoop[i] = 3;
+        lead[i] = i;
+    }
+    int *tris = (int *)malloc(max(t->n, 1) * 3 * sizeof(int)); //every face's corners in that winding, the loops change as faces are joined
+    for(i=0;i < t->n && tris;i++)
+        memcpy(&tris[i*3], &loops[i * MAX_POLYGON_POINTS], 3 * sizeof(int));
+
+    int *vertexStart = NULL, *vertexFaceList = NULL;
+    if(MERGE_FACES && tris && vertexFaces(t, nVectors, &vertexStart, &vertexFaceList))
+    {
+        int merged[MAX_POLYGON_POINTS * 2];
+        for(i=0;i < t->n;i++)
+        {
+            if(t->flags[i] & 1)
+                continue;
+            vec3 n = faceNormal(t, i);
+            for(k=0;k < 3;k++)
+            {
+                int a = tris[i*3 + k], b = tris[i*3 + (k+1)%3];
+                for(j=vertexStart[a];j < vertexStart[a + 1];j++)
+                {
+                    int other = vertexFaceList[j], m, *q = &tris[other*3];
+                    if(other == i || (t->flags[other] & 1) || t->texture[other] != t->texture[i] || dot(faceNormal(t, other), n) < 0.999 || fabs(t->planes[other*4 + 3] - t->planes[i*4 + 3]) > COPLANAR_EPSILON)
+                        continue;
+                    for(m=0;m < 3 && (q[m] != b || q[(m+1)%3] != a);m++); //faces on the same side of a plane wound the same way have their shared edge going opposite ways
+                    if(m == 3)
+                        continue;
+                    int leadI = i, leadOther = other, nMerged;
+                    while(lead[leadI] != leadI)
+                        leadI = lead[leadI];
+                    while(lead[leadOther] != leadOther)
+                        leadOther = lead[leadOther];
+                    if(leadI == leadOther || !mergeLoops(&loops[leadI * MAX_POLYGON_POINTS], nLoop[leadI], &loops[leadOther * MAX_POLYGON_POINTS], nLoop[leadOther], a, b, vectors, n, merged, &nMerged))
+                        continue;
+                    int first = min(leadI, leadOther);
+                    memcpy(&loops[first * MAX_POLYGON_POINTS], merged, nMerged * sizeof(int));
+                    nLoop[first] = nMerged;
+                    lead[leadI] = lead[leadOther] = first;
+                }
+            }
+        }
+    }
+
+    int nPoints = 0;
+    t->nPolygons = 0;
+    for(i=0;i < t->n;i++)
+    {
+        t->polygonStart[i] = nPoints;
+        if(lead[i] != i)
+            continue;
+        int n = nLoop[i];
+        if(n > 3)
+            n = removeStraightCorners(&loops[i * MAX_POLYGON_POINTS], n, vectors, faceNormal(t, i), i, lead, vertexStart, vertexFaceList);
+        else //joining always gives more than 3 corners, so this face is on its own and keeps its corners in the order they were given
+            memcpy(&loops[i * MAX_POLYGON_POINTS], &t->indices[i*3], 3 * sizeof(int));
+        memcpy(&t->polygonPoints[nPoints], &loops[i * MAX_POLYGON_POINTS], n * sizeof(int));
+        nPoints += n;
+        t->nPolygons++;
+    }
+    t->polygonStart[t->n] = nPoints;
+    free(loops);
+    free(nLoop);
+    free(lead);
+    free(tris);
+    free(vertexStart);
+    free(vertexFaceList);
+}
+
+/*
+joins two polygons along the edge edgeStart to edgeEnd, which goes that way round a and the other way round b
+false if it isn't an edge of both, or the result would have too many corners or not be convex
+*/
+bool mergeLoops(int *a, int nA, int *b, int nB, int edgeStart, int edgeEnd, vec3 *vectors, vec3 norm, int *merged, int *nMerged)
+{
+    int i, j, startA = -1, startB = -1;
+    for(i=0;i < nA;i++)
+        if(a[i] == edgeStart && a[(i+1)%nA] == edgeEnd)
+            startA = i;
+    for(i=0;i < nB;i++)
+        if(b[i] == edgeEnd && b[(i+1)%nB] == edgeStart)
+            startB = i;
+    if(startA < 0 || startB < 0 || nA + nB - 2 > MAX_POLYGON_POINTS)
+        return false;
+    *nMerged = 0;
+    for(i=0;i < nA;i++) //round a from the end of the edge back to its start, then round b between the two
+        merged[(*nMerged)++] = a[(startA + 1 + i) % nA];
+    for(j=2;j < nB;j++)
+        merged[(*nMerged)++] = b[(startB + j) % nB];
+    for(i=0;i < *nMerged;i++)
+    {
+        vec3 p = vectors[merged[i]], q = vectors[merged[(i+1) % *nMerged]], r = vectors[merged[(i+2) % *nMerged]];
+        if(cornerTurn(p, q, r, norm) < -COPLANAR_EPSILON || (cornerTurn(p, q, r, norm) <= COPLANAR_EPSILON && dot(sub(q, p), sub(r, q)) <= 0)) //turns the wrong way, or doubles back on itself
+            return false;
+    }
+    return true;
+}
+
+/*
+corners in the middle of a straight edge, left by merging a fan, don't change what's filled, returns how many are left
+group is the face the polygon was merged into, a corner is kept if a face outside the group also ends there, or that face's edge would meet the middle of this one and the two could fill different pixels along it
+*/
+int removeStraightCorners(int *loop, int n, vec3 *vectors, vec3 norm, int group, int *lead, int *vertexStart, int *vertexFaceList)
+{
+    int i = 0, j;
+    while(n > 3 && i < n)
+    {
+        bool shared = false;
+        for(j=vertexStart[loop[i]];j < vertexStart[loop[i] + 1] && !shared;j++)
+        {
+            int other = vertexFaceList[j];
+            while(lead[other] != other)
+                other = lead[other];
+            shared = other != group;
+        }
+        if(!shared && fabs(cornerTurn(vectors[loop[(i + n - 1) % n]], vectors[loop[i]], vectors[loop[(i+1) % n]], norm)) <= COPLANAR_EPSILON)
+        {
+            memmove(&loop[i], &loop[i+1], (n - i - 1) * sizeof(int));
+            n--;
+        }
+        else
+            i++;
+    }
+    return n;
+}
+
+float cornerTurn(vec3 a, vec3 b, vec3 c, vec3 norm) //positive if going a, b, c turns the same way as the face's winding around norm
+{
+    return dot(cross(sub(b, a), sub(c, b)), norm);
+}
+
+int facePolygon(faceTable *t, int i, int **polygon) //points *polygon at face i's polygon, returns how many corners it has, 0 if it was merged into another
+{
+    *polygon = &t->polygonPoints[t->polygonStart[i]];
+    return t->polygonStart[i + 1] - t->polygonStart[i];
+}
+
+bool polygonIsFace(faceTable *t, int i) //true if nothing was merged with face i
+{
+    int *p;
+    return facePolygon(t, i, &p) == 3 && p[0] == t->indices[i*3] && p[1] == t->indices[i*3 + 1] && p[2] == t->indices[i*3 + 2];
+}
+
+int occluderPolygon(faceTable *t, int i, int *polygon) //vertex indexes of face i, or of the quad it makes with its pair, in the face's winding order, returns how many
+{
+    int *p = &t->indices[i*3];
+    int k;
+    if(t->occluderPair[i] >= 0)
+    {
+        int *q = &t->indices[t->occluderPair[i]*3];
+        for(k=0;k < 3;k++) //find the shared edge, the pair's other vertex goes between its ends
+        {
+            int m, shared = 0, third = -1;
+            for(m=0;m < 3;m++)
+            {
+                if(q[m] == p[k] || q[m] == p[(k+1)%3])
+                    shared++;
+                else
+                    third = q[m];
+            }
+            if(shared == 2)
+            {
+                polygon[0] = p[k];
+                polygon[1] = third;
+                polygon[2] = p[(k+1)%3];
+                polygon[3] = p[(k+2)%3];
+                return 4;
+            }
+        }
+    }
+    for(k=0;k < 3;k++)
+        polygon[k] = p[k];
+    return 3;
+}
+
+bool clusterBackfacing(faceCluster *c, vec3 pos) //true if every face in the cluster faces away from pos, can give false when they all do but never true when one doesn't
+{
+    vec3 toCentre = sub(c->centre, pos);
+    return dot(toCentre, c->axis) >= c->cutoff * length(toCentre) + c->radius;
+}
+
+
+#define OFFSET 100.0 //temporary until the offset value is added to the face struct
+
+//nothing collides against the clip vectors yet, so loading doesn't build them, -bench still times this for when something does
+
+void buildClipVectors(int nVectors, vec3 *mapVectors, faceTable *mapFaces, vec3 *clipVectors, arena *loadArena) //sorry, clip machine broke
+{
+    int nFaces = mapFaces->n;
+    int *linkedFaces = arenaAlloc(loadArena, sizeof(int) * (nFaces + 1)); //indexes of the faces using a vertex, a vertex can't be linked to more faces than there are, so one buffer does for every vertex
+    int *idx = mapFaces->indices;
+    int i;
+    for(i=0;i < nVectors;i++)
+    {
+        int j;
+        int nLinkedFaces = 0;
+        for(j=0;j < nFaces;j++)
+            if(idx[j*3] == i || idx[j*3 + 1] == i || idx[j*3 + 2] == i)
+                linkedFaces[nLinkedFaces++] = j;
+
+        if(nLinkedFaces == 0) //gg
+            continue;
+        linkedFaces[nLinkedFaces] = -1; //the searches below stop here if every face has been used
+
+        int nFinalFaces = nLinkedFaces;
+
+        int k;
+        for(j=0;j < nLinkedFaces;j++) //-1 marks a face that has been used up
+            for(k=j+1; linkedFaces[j] != -1 && k < nLinkedFaces;k++)
+            {
+                vec3 normJ = faceNormal(mapFaces, linkedFaces[j]);
+                vec3 normK = linkedFaces[k] != -1 ? faceNormal(mapFaces, linkedFaces[k]) : normJ;
+                if(linkedFaces[k] != -1 && fabs(normK.x) == fabs(normJ.x) && fabs(normK.y) == fabs(normJ.y) && fabs(normK.z) == fabs(normJ.z))
+                {
+                    //printf("wew");
+                    linkedFaces[k] = -1;
+                    nFinalFaces--;
+                }
+            }
+
+        int faceNum;
+        if(nFinalFaces == 1)
+        {
+            for(faceNum=0;linkedFaces[faceNum] == -1 && faceNum < nLinkedFaces;faceNum++);
+            clipVectors[i] = add(mapVectors[i], mul(faceNormal(mapFaces, linkedFaces[faceNum]), OFFSET));
+        }
+        else
+        {
+            vec3 norm1, norm2, norm3;
+            vec3 origin1, origin2, origin3;
+            float d1, d2, d3;
+
+            for(faceNum=0;linkedFaces[faceNum] == -1 && faceNum < nLinkedFaces;faceNum++);
+            norm1 = faceNormal(mapFaces, linkedFaces[faceNum]);
+
+            //origin1 = add(mapVectors[i], mul(norm1, OFFSET));
+            origin1 = add(mapVectors[idx[linkedFaces[faceNum]*3]], mul(norm1, OFFSET));
+            linkedFaces[faceNum] = -1;
+
+            for(faceNum=0;linkedFaces[faceNum] == -1 && faceNum < nLinkedFaces;faceNum++);
+            if(faceNum == nLinkedFaces) //every face the vertex is on is parallel to the first one
+            {
+                clipVectors[i] = add(mapVectors[i], mul(norm1, OFFSET));
+                continue;
             }
+            norm2 = faceNormal(mapFaces, linkedFaces[faceNum]);
             //origin2 = add(mapVectors[i], mul(norm2, OFFSET));
-            origin2 = add(mapVectors[linkedFaces[faceNum].p1], mul(norm2, OFFSET));
-            linkedFaces[faceNum].type = -1;
+            origin2 = add(mapVectors[idx[linkedFaces[faceNum]*3]], mul(norm2, OFFSET));
+            linkedFaces[faceNum] = -1;
+
+            nFinalFaces -= 2;
+
+            do
+            {
+                for(faceNum=0;faceNum < nLinkedFaces && linkedFaces[faceNum] == -1;faceNum++);
+                if(faceNum == nLinkedFaces) //ran out of faces, use the plane through the vertex along the edge of the other two
+                {
+                    norm3 = unit(cross(norm1, norm2));
+                    origin3 = mapVectors[i];
+                    break;
+                }
+                norm3 = faceNormal(mapFaces, linkedFaces[faceNum]);
+                //origin3 = add(mapVectors[i], mul(norm3, OFFSET));
+                origin3 = add(mapVectors[idx[linkedFaces[faceNum]*3]], mul(norm3, OFFSET));
+                linkedFaces[faceNum] = -1;
+                nFinalFaces--;
+            }
+            while(dot(norm1, cross(norm2, norm3)) == 0);
+
+
+            d1 = dot(origin1, norm1);
+            d2 = dot(origin2, norm2);
+            d3 = dot(origin3, norm3);
+
+            /*
+            vec3 lStart, lNorm;
+            lNorm = unit(cross(norm1, norm2));
+
+            float lineX = fabs(lNorm.x);
+            float lineY = fabs(lNorm.y);
+            float lineZ = fabs(lNorm.z);
+
+            if(lineX > lineY && lineX > lineZ)
+            {
+                lStart.x = 0;
+                float det = norm1.y * norm2.z - norm1.z * norm2.y;
+                lStart.y = (norm2.z * d1 - norm1.z * d2) / det;
+                lStart.z = (norm1.y * d2 - norm2.y * d1) / det;
+            }
+            else if(lineY > lineZ)
+            {
+                lStart.y = 0;
+                float det = norm1.x * norm2.z - norm1.z * norm2.x;
+                lStart.x = (norm2.z * d1 - norm1.z * d2) / det;
+                lStart.z = (norm1.x * d2 - norm2.x * d1) / det;
+            }
+            else
+            {
+                lStart.z = 0;
+                float det = norm1.x * norm2.y - norm1.y * norm2.x;
+                lStart.x = (norm2.z * d1 - norm1.z * d2) / det;
+                lStart.y = (norm1.x * d2 - norm2.x * d1) / det;
+            }
+
+            printf("%d %d %d %0.4f %0.4f %0.4f\n", i, nLinkedFaces, nFinalFaces, d1, d2, dot(lNorm, norm3));
+
+            if(i == 14 || i == 15)
+            {
+                printf("%0.3f %0.3f %0.3f   ", lNorm.x, lNorm.y, lNorm.z);
+                printf("%0.3f %0.3f %0.3f   ", norm1.x, norm1.y, norm1.z);
+                printf("%0.3f %0.3f %0.3f\n", norm2.x, norm2.y, norm2.z);
+            }
+
+            if(dot(lNorm, norm3) != 0)
+                clipVectors[i] = add(lStart, mul(lNorm, (d3 - dot(lStart, norm3)) / dot(lNorm, norm3)));
+            else
+                clipVectors[i] = mapVectors[i];
+
+            */
+
+
+            float det = dot(norm1, cross(norm2, norm3));
+
+            //printf("%d %f %d %d %0.4f %0.4f %0.4f\n", i, det, nLinkedFaces, nFinalFaces, length(norm1), length(norm2), length(norm3));
+
+            if(i == 14 && i == 15 && false)
+            {
+                printf("%0.3f %0.3f %0.3f   ", norm1.x, norm1.y, norm1.z);
+                printf("%0.3f %0.3f %0.3f   ", norm2.x, norm2.y, norm2.z);
+                printf("%0.3f %0.3f %0.3f\n", norm3.x, norm3.y, norm3.z);
+            }
+
+
+            if(det != 0) //if two of the planes being used were too similar in orientation, det would be too small and cause division overflow
+                clipVectors[i] = mul(add(mul(cross(norm2, norm3),d1), add(mul(cross(norm3, norm1),d2), mul(cross(norm1, norm2),d3))), 1.0/det);
+            //else
+                //clipVectors[i] = mapVectors[i];
+
+        }
+    }
+
+}
+
+
+void loadConstants(int *w, int *h, float *sens, char *map, float *frustumW, float *frustumN, int *edges, char *fileName)
+{
+    FILE *settingsFile = fopen(fileName, "r");
+    fscanf(settingsFile, "map = %[^\n]\n", map);
+    fscanf(settingsFile, "width = %d\n", w);
+    fscanf(settingsFile, "height = %d\n", h);
+    fscanf(settingsFile, "sensitivity = %f\n", sens);
+    fscanf(settingsFile, "frustum width = %f\n", frustumW);
+    fscanf(settingsFile, "frustum near length = %f\n", frustumN);
+    fscanf(settingsFile, "draw edges = %d\n", edges);
+
+    //settings after this point are optional and can be in any order, missing ones keep their default values
+    char key[40], value[40];
+    while(fscanf(settingsFile, "%39[^=]= %39[^\n]\n", key, value) == 2)
+        loadOptionalSetting(key, value);
+    fclose(settingsFile);
+}
+
+void loadOptionalSetting(char *key, char *value)
+{
+    int end = strlen(key);
+    while(end > 0 && (key[end - 1] == ' ' || key[end - 1] == '\t')) //remove the spaces between the key and the '='
+        key[--end] = '\0';
+
+    if(strcmp(key, "dynamic resolution") == 0)
+        DYNAMIC_RESOLUTION = atoi(value);
+    else if(strcmp(key, "min render scale") == 0)
+        MIN_RENDER_SCALE = atof(value);
+    else if(strcmp(key, "max render scale") == 0)
+        MAX_RENDER_SCALE = atof(value);
+    else if(strcmp(key, "target raster time") == 0)
+        TARGET_RASTER_TIME = atof(value);
+    else if(strcmp(key, "entities") == 0)
+        ENTITY_COUNT = atoi(value);
+    else if(strcmp(key, "entity radius") == 0)
+        ENTITY_RADIUS = atof(value);
+    else if(strcmp(key, "span buffer") == 0)
+        SPAN_BUFFER = atoi(value);
+    else if(strcmp(key, "pipelined") == 0)
+        PIPELINED = atoi(value);
+    else if(strcmp(key, "reuse frames") == 0)
+        REUSE_FRAMES = atoi(value);
+    else if(strcmp(key, "indexed framebuffer") == 0)
+        INDEXED_FRAMEBUFFER = atoi(value);
+    else if(strcmp(key, "occlusion culling") == 0)
+        OCCLUSION_CULL = atoi(value);
+    else if(strcmp(key, "render stats") == 0)
+        RENDER_STATS = atoi(value);
+    else if(strcmp(key, "stats file") == 0)
+        strcpy(STATS_FILE, value);
+    else if(strcmp(key, "overdraw view") == 0)
+        OVERDRAW_VIEW = atoi(value);
+    else if(strcmp(key, "late latch") == 0)
+        LATE_LATCH = atoi(value);
+    else if(strcmp(key, "merge faces") == 0)
+        MERGE_FACES = atoi(value);
+    else if(strcmp(key, "job threads") == 0)
+        JOB_THREADS = atoi(value);
+    else
+        printf("unknown setting: %s\n", key);
+}
+
+void writeStatsHeader(FILE *file)
+{
+    fprintf(file, "frame,raster ms,reused,width,height,faces tested,backface culled,frustum culled,occlusion culled,faces drawn,near clipped,triangles,pixels,clip iterations\n");
+}
+
+void writeStats(FILE *file, int frame, float rasterTime, bool reused, renderStats *stats) //one csv line, a reused frame has nothing drawn so its counts are 0 apart from the collision ones
+{
+    fprintf(file, "%d,%0.3f,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d\n", frame, rasterTime, reused, WIDTH, HEIGHT, stats->facesTested, stats->backfaceCulled, stats->frustumCulled, stats->occlusionCulled,
+            stats->facesDrawn, stats->nearClipped, stats->trianglesRasterized, stats->pixelsRasterized, stats->clipIterations);
+}
+
+void showStats(SDL_Window *window, renderStats *stats) //there's no text drawing, so the counts go in the window title
+{
+    char title[256];
+    snprintf(title, sizeof(title), "Dank meme | faces %d tested %d drawn, culled %d back %d frustum %d occluded, %d near clipped | %d triangles %d pixels %0.2fx overdraw | %d clip iterations",
+             stats->facesTested, stats->facesDrawn, stats->backfaceCulled, stats->frustumCulled, stats->occlusionCulled, stats->nearClipped,
+             stats->trianglesRasterized, stats->pixelsRasterized, (float)stats->pixelsRasterized / (WIDTH * HEIGHT), stats->clipIterations);
+    SDL_SetWindowTitle(window, title);
+}
+
+void printLatency(int *counts) //percentiles of the time from each mouse event to the present that first showed it
+{
+    int i, n = 0;
+    for(i=0;i < LATENCY_BUCKETS;i++)
+        n += counts[i];
+    if(n == 0)
+        return;
+    printf("input to present latency: %d mouse events, 50%% %d ms, 90%% %d ms, 99%% %d ms, worst %d ms%s\n", n, latencyPercentile(counts, n, 0.5), latencyPercentile(counts, n, 0.9), latencyPercentile(counts, n, 0.99),
+           latencyPercentile(counts, n, 1.0), counts[LATENCY_BUCKETS - 1] > 0 ? " or more" : "");
+}
+
+int latencyPercentile(int *counts, int n, float fraction) //ms under which at least fraction of the n counted events were presented
+{
+    int i, total = 0;
+    for(i=0;i < LATENCY_BUCKETS - 1;i++)
+    {
+        total += counts[i];
+        if(total >= fraction * n)
+            return i;
+    }
+    return LATENCY_BUCKETS - 1;
+}
+
+void setRenderScale(float scale) //sets the internal resolution as a fraction of the window size
+{
+    WIDTH = max(WINDOW_WIDTH * scale, 1);
+    HEIGHT = max(WINDOW_HEIGHT * scale, 1);
+}
+
+/*
+the raster time of the last few frames is averaged, and once enough frames have been measured the scale is changed
+since raster cost goes up with the number of pixels, the scale is changed by the square root of how far off the target the average is
+scaling up is done more slowly than scaling down so it doesn't bounce between two sizes
+*/
+float updateRenderScale(float scale, float rasterTime, float *history, int *nHistory)
+{
+    history[(*nHistory)++] = rasterTime;
+    if(*nHistory < RESOLUTION_HISTORY)
+        return scale;
+    *nHistory = 0;
+
+    float average = 0;
+    int i;
+    for(i=0;i < RESOLUTION_HISTORY;i++)
+        average += history[i];
+    average /= RESOLUTION_HISTORY;
+
+    if(average > TARGET_RASTER_TIME) //over budget, drop the resolution straight away
+        scale *= sqrt(TARGET_RASTER_TIME / average);
+    else if(average < TARGET_RASTER_TIME * 0.7) //comfortably under budget, raise it a bit at a time
+        scale *= min(sqrt(TARGET_RASTER_TIME * 0.85 / max(average, 0.01)), 1.1);
+
+    return clamp(scale, MIN_RENDER_SCALE, MAX_RENDER_SCALE);
+}
+
+void drawFilledFaces(faceTable *faces, camera player, vec3 *points, SDL_Renderer *renderer, colour *colours, SDL_Surface **textures, mesh *meshes, meshInstance *instances, int nInstances, arena *frameArena, indexedFrame *indexed, jobPool *jobs, renderStats *stats)
+{
+    //faces of instances that can be seen are copied out with their vertices moved into world space, then drawn the same way as map faces
+    //indexes from nFaces up in facesIndex refer to these
+    view eye = cameraView(player);
+    int i, nInstFaces = 0, nInstPoints = 0;
+    for(i=0;i < nInstances;i++)
+    {
+        nInstFaces += meshes[instances[i].mesh].nFaces;
+        nInstPoints += meshes[instances[i].mesh].nVectors;
+    }
+    face *instFaces = arenaAlloc(frameArena, nInstFaces * sizeof(face));
+    vec3 *instPoints = arenaAlloc(frameArena, nInstPoints * sizeof(vec3));
+
+    //culling, depth keys and projection are split over the job pool, everything they write is per face so the results come out the same on any number of threads
+    int nFaces = faces->n;
+    frontEnd fe;
+    memset(&fe, 0, sizeof(frontEnd));
+    fe.faces = faces;
+    fe.points = points;
+    fe.instFaces = instFaces;
+    fe.instPoints = instPoints;
+    fe.nFaces = nFaces;
+    fe.eye = eye;
+
+    stats->facesTested += faces->nPolygons + nInstFaces;
+    int *facesIndex = arenaAlloc(frameArena, (nFaces + nInstFaces) * sizeof(int)); //index of each visible face
+    int *clusterEnd = arenaAlloc(frameArena, faces->nClusters * sizeof(int)); //where each cluster's faces stop in facesIndex, -1 if the whole cluster was culled
+    fe.clusterVisible = arenaAlloc(frameArena, nFaces * sizeof(int));
+    fe.clusterCount = arenaAlloc(frameArena, faces->nClusters * sizeof(int));
+    parallelFor(jobs, faces->nClusters, JOB_GRAIN / CLUSTER_MAX_FACES, cullClustersJob, &fe);
+
+    int nVisible = 0;
+    int c, j;
+    for(c=0;c < faces->nClusters;c++) //pack what each cluster kept into facesIndex, in the same order as testing them one after another
+    {
+        clusterEnd[c] = -1;
+        if(fe.clusterCount[c] < 0)
+            continue;
+        for(j=0;j < fe.clusterCount[c];j++)
+            facesIndex[nVisible++] = fe.clusterVisible[faces->clusters[c].first + j];
+        clusterEnd[c] = nVisible;
+    }
+
+    //the map faces left are drawn into the occlusion buffer, then clusters, faces and instances behind them are thrown away
+    occlusionBuffer occlusion;
+    if(OCCLUSION_CULL)
+    {
+        occlusionInit(&occlusion, WIDTH, HEIGHT, frameArena);
+        for(i=0;i < nVisible;i++)
+        {
+            int pair = faces->occluderPair[facesIndex[i]];
+            if(pair >= 0 && pair < facesIndex[i]) //a quad is drawn once, from its lower face, which faces the same way so it's in view too
+                continue;
+            int quad[4], *polygon = quad, n = polygonIsFace(faces, facesIndex[i]) ? occluderPolygon(faces, facesIndex[i], quad) : facePolygon(faces, facesIndex[i], &polygon);
+            vec3 pointsR[MAX_POLYGON_POINTS];
+            for(j=0;j < n;j++)
+                pointsR[j] = toView(&eye, points[polygon[j]]);
+            occlusionDrawPolygon(&occlusion, pointsR, n);
+        }
+        occlusionBuildPyramid(&occlusion);
+
+        int start = 0, nKept = 0;
+        for(c=0;c < faces->nClusters;c++)
+        {
+            if(clusterEnd[c] < 0)
+                continue;
+            vec3 box[8];
+            boxCorners(faces->clusters[c].centre, faces->clusters[c].radius, box);
+            if(!occluded(&occlusion, box, 8, &eye))
+                for(j=start;j < clusterEnd[c];j++)
+                {
+                    int k, *polygon, n = facePolygon(faces, facesIndex[j], &polygon);
+                    vec3 corners[MAX_POLYGON_POINTS];
+                    for(k=0;k < n;k++)
+                        corners[k] = points[polygon[k]];
+                    if(!occluded(&occlusion, corners, n, &eye))
+                        facesIndex[nKept++] = facesIndex[j];
+                    else
+                        stats->occlusionCulled++;
+                }
+            else
+                stats->occlusionCulled += clusterEnd[c] - start;
+            start = clusterEnd[c];
+        }
+        nVisible = nKept;
+    }
+
+    nInstFaces = nInstPoints = 0;
+    for(i=0;i < nInstances;i++)
+    {
+        float radius = meshes[instances[i].mesh].radius;
+        vec3 box[8];
+        boxCorners(instances[i].pos, radius * instances[i].scale, box);
+        if(!instanceVisible(instances[i], radius, &eye))
+            stats->frustumCulled += meshes[instances[i].mesh].nFaces;
+        else if(OCCLUSION_CULL && occluded(&occlusion, box, 8, &eye))
+            stats->occlusionCulled += meshes[instances[i].mesh].nFaces;
+        else
+            nInstFaces += placeInstance(meshes[instances[i].mesh], instances[i], instFaces + nInstFaces, instPoints, &nInstPoints);
+    }
+    fe.instVisible = arenaAlloc(frameArena, nInstFaces * sizeof(bool));
+    parallelFor(jobs, nInstFaces, JOB_GRAIN, cullInstanceFacesJob, &fe);
+    for(i=0;i < nInstFaces;i++)
+        if(fe.instVisible[i])
+            facesIndex[nVisible++] = nFaces + i;
+
+    for(i=0;i < MAX_JOB_THREADS;i++)
+    {
+        stats->backfaceCulled += fe.backfaceCulled[i];
+        stats->frustumCulled += fe.frustumCulled[i];
+    }
+
+    if(nVisible > 0)
+    {
+        fe.facesIndex = facesIndex;
+        fe.nVisible = nVisible;
+        fe.dist = arenaAlloc(frameArena, (nFaces + nInstFaces) * sizeof(float));//sort facesIndex based on median depth value of each corner of the triangle after translation and rotation relative to player
+        parallelFor(jobs, nVisible, JOB_GRAIN, faceDepthJob, &fe);
+
+        quicksort(facesIndex, fe.dist, 0, nVisible-1);
+
+        //fill in order from furthest to closest (painter's algorithm), or closest to furthest through the span buffer until every row is full
+        //faces are projected a batch at a time on the job pool just before they're filled
+        spanBuffer spans;
+        if(SPAN_BUFFER)
+            spanBufferInit(&spans, WIDTH, HEIGHT, frameArena);
+        fe.projected = arenaAlloc(frameArena, (nVisible < PROJECT_BATCH ? nVisible : PROJECT_BATCH) * sizeof(projectedFace));
+        int n;
+        for(n=0;n < nVisible && (!SPAN_BUFFER || spans.rowsLeft > 0);n++)
+        {
+            if(n % PROJECT_BATCH == 0)
+            {
+                fe.batchStart = n;
+                parallelFor(jobs, nVisible - n < PROJECT_BATCH ? nVisible - n : PROJECT_BATCH, JOB_GRAIN, projectFacesJob, &fe);
+            }
+            i = SPAN_BUFFER ? n : nVisible - 1 - n;
+            face f = facesIndex[i] < nFaces ? getFace(faces, facesIndex[i]) : instFaces[facesIndex[i] - nFaces];
+            if((f.flags & 1) == 1 && !textures[f.texture]) //texture hasn't been decoded yet (or couldn't be), fill it flat for now
+            {
+                f.flags &= ~1;
+                SDL_SetRenderDrawColor(renderer, TEXTURE_LOADING_GREY, TEXTURE_LOADING_GREY, TEXTURE_LOADING_GREY, SDL_ALPHA_OPAQUE);
+                if(indexed)
+                    indexed->colour = INDEXED_LOADING_GREY;
+            }
+            else if((f.flags & 1) == 0)
+            {
+                SDL_SetRenderDrawColor(renderer, colours[f.texture].r, colours[f.texture].g, colours[f.texture].b, SDL_ALPHA_OPAQUE);
+                if(indexed)
+                    indexed->colour = INDEXED_MAP_COLOURS + f.texture;
+            }
+            drawFace(f, &fe.projected[n - fe.batchStart], renderer, textures, SPAN_BUFFER ? &spans : NULL, indexed, stats);
+        }
+
+    }
+
+}
+
+void cullClustersJob(void *data, int first, int last, int thread) //cull faces which are facing away from the player, or are behind the player, only the hot arrays of the map's faces are read here
+{
+    frontEnd *fe = data;
+    faceTable *faces = fe->faces;
+    int backfaceCulled = 0, frustumCulled = 0;
+    int c, j;
+    for(c=first;c < last;c++)
+    {
+        faceCluster *cluster = &faces->clusters[c];
+        fe->clusterCount[c] = -1;
+        if(BACKFACE_CULL_FILL && clusterBackfacing(cluster, fe->eye.pos)) //the whole cluster faces away, none of its faces need testing
+        {
+            backfaceCulled += cluster->n;
+            continue;
+        }
+        int *visible = fe->clusterVisible + cluster->first, nVisible = 0;
+        for(j=cluster->first;j < cluster->first + cluster->n;j++)
+        {
+            int i = faces->clusterFaces[j];
+            vec3 norm = faceNormal(faces, i);
+            int *polygon, n = facePolygon(faces, i, &polygon);
+            if(faceVisible(polygon, n, norm, faces->planes[i*4 + 3], fe->points, &fe->eye))
+                visible[nVisible++] = i;
+            else if(BACKFACE_CULL_FILL && dot(fe->eye.pos, norm) - faces->planes[i*4 + 3] < 0)
+                backfaceCulled++;
+            else
+                frustumCulled++;
+        }
+        fe->clusterCount[c] = nVisible;
+    }
+    fe->backfaceCulled[thread] += backfaceCulled;
+    fe->frustumCulled[thread] += frustumCulled;
+}
+
+void cullInstanceFacesJob(void *data, int first, int last, int thread)
+{
+    frontEnd *fe = data;
+    int backfaceCulled = 0, frustumCulled = 0;
+    int i;
+    for(i=first;i < last;i++)
+    {
+        face *f = &fe->instFaces[i];
+        float planeD = dot(fe->instPoints[f->p1], f->norm);
+        int corners[3] = {f->p1, f->p2, f->p3};
+        fe->instVisible[i] = faceVisible(corners, 3, f->norm, planeD, fe->instPoints, &fe->eye);
+        if(!fe->instVisible[i] && BACKFACE_CULL_FILL && dot(fe->eye.pos, f->norm) - planeD < 0)
+            backfaceCulled++;
+        else if(!fe->instVisible[i])
+            frustumCulled++;
+    }
+    fe->backfaceCulled[thread] += backfaceCulled;
+    fe->frustumCulled[thread] += frustumCulled;
+}
+
+void faceDepthJob(void *data, int first, int last, int thread)
+{
+    frontEnd *fe = data;
+    int i;
+    for(i=first;i < last;i++)
+    {
+        int corners[3], *polygon;
+        vec3 *points;
+        int n = visiblePolygon(fe, fe->facesIndex[i], corners, &polygon, &points);
+        fe->dist[fe->facesIndex[i]] = faceDepth(polygon, n, points, &fe->eye);
+    }
+}
+
+void projectFacesJob(void *data, int first, int last, int thread) //items are positions in the batch, which start at batchStart in draw order
+{
+    frontEnd *fe = data;
+    int k;
+    for(k=first;k < last;k++)
+    {
+        int n = fe->batchStart + k;
+        int index = fe->facesIndex[SPAN_BUFFER ? n : fe->nVisible - 1 - n];
+        int corners[3], *polygon;
+        vec3 *points;
+        int nPolygon = visiblePolygon(fe, index, corners, &polygon, &points);
+        projectFace(polygon, nPolygon, points, &fe->eye, &fe->projected[k]);
+    }
+}
+
+int visiblePolygon(frontEnd *fe, int index, int *corners, int **polygon, vec3 **points) //corners of the face at index in facesIndex and the points they index, corners is filled in for instance faces, which are always triangles
+{
+    if(index < fe->nFaces)
+    {
+        *points = fe->points;
+        return facePolygon(fe->faces, index, polygon);
+    }
+    face *f = &fe->instFaces[index - fe->nFaces];
+    corners[0] = f->p1;
+    corners[1] = f->p2;
+    corners[2] = f->p3;
+    *polygon = corners;
+    *points = fe->instPoints;
+    return 3;
+}
+
+view cameraView(camera player) //rotateX(rotateZ(p - pos, -yaw), -pitch) as one matrix
+{
+    view r = {.pos = player.pos, .rotation = mat3Mul(mat3RotateX(-player.pitch), mat3RotateZ(-player.yaw))};
+    return r;
+}
+
+vec3 toView(view *eye, vec3 p) //world space to camera space, +y is forward
+{
+    return mat3Apply(eye->rotation, sub(p, eye->pos));
+}
+
+bool faceVisible(int *polygon, int n, vec3 norm, float planeD, vec3 *points, view *eye) //false if the face is facing away from the player, or is behind the player, planeD is dot(points[polygon[0]], norm)
+{
+    vec3 forward = eye->rotation.y; //only the depth of each corner is needed
+    if(BACKFACE_CULL_FILL && dot(eye->pos, norm) - planeD < 0)
+        return false;
+    int i;
+    for(i=0;i < n;i++)
+        if(dot(forward, sub(points[polygon[i]], eye->pos)) >= FRUSTUM_NEAR_LENGTH)
+            return true;
+    return false;
+}
+
+/*
+painter's sort key, the average distance to the corners of the part of the face in front of the near plane, times 3 like the sum over a triangle
+corners behind the player would otherwise push a big floor or wall back behind the smaller faces it shares a corner with
+*/
+float faceDepth(int *polygon, int n, vec3 *points, view *eye)
+{
+    float total = 0;
+    int i, m = 0;
+    for(i=0;i < n;i++)
+    {
+        vec3 a = toView(eye, points[polygon[i]]), b = toView(eye, points[polygon[(i+1)%n]]);
+        if(a.y >= FRUSTUM_NEAR_LENGTH)
+        {
+            total += length(a);
+            m++;
+        }
+        if((a.y >= FRUSTUM_NEAR_LENGTH) != (b.y >= FRUSTUM_NEAR_LENGTH)) //edge crosses the near plane, the crossing is a corner of the clipped face
+        {
+            total += length(add(a, mul(sub(b, a), (FRUSTUM_NEAR_LENGTH - a.y) / (b.y - a.y))));
+            m++;
+        }
+    }
+    return m > 0 ? total * 3 / m : INFINITY;
+}
+
+bool instanceVisible(meshInstance instance, float radius, view *eye) //tests the instance's bounding sphere against the near plane and the sides of the view frustum
+{
+    vec3 c = toView(eye, instance.pos);
+    float r = radius * instance.scale;
+    float side = FRUSTUM_WIDTH; //x is on screen while |x| * FRUSTUM_WIDTH <= y
+    float vertical = FRUSTUM_WIDTH * (float)WIDTH / (float)HEIGHT; //same for z, the screen is HEIGHT tall instead of WIDTH wide
+    return c.y + r >= FRUSTUM_NEAR_LENGTH
+        && (c.y - side * fabs(c.x)) / sqrt(1 + side * side) >= -r
+        && (c.y - vertical * fabs(c.z)) / sqrt(1 + vertical * vertical) >= -r;
+}
+
+bool sameView(camera a, camera b) //true if a frame drawn from a looks exactly like one drawn from b
+{
+    return a.pos.x == b.pos.x && a.pos.y == b.pos.y && a.pos.z == b.pos.z && a.yaw == b.yaw && a.pitch == b.pitch;
+}
 
-            nFinalFaces -= 2;
+vec3 instancePoint(meshInstance instance, vec3 p) //mesh space to world space
+{
+    return mat4ApplyPoint(instanceMatrix(instance), p);
+}
 
-            do
-            {
-                if(nFinalFaces <= 0 && false)
-                {
-                    norm3 = unit(cross(norm1, norm2));
-                    origin3 = mapVectors[i];
-                    break;
-                }
-                else
-                {
-                    for(faceNum=0;faceNum < nLinkedFaces && linkedFaces[faceNum].type == -1;faceNum++);
-                    norm3 = linkedFaces[faceNum].norm;
-                    if(i == 15 && nFinalFaces  > 1)
-                    {
-                        int rip;
-                        for(rip=0;rip < nFaces;rip++)
-                            if(mapFaces[rip].p1 == linkedFaces[faceNum].p1 && mapFaces[rip].p2 == linkedFaces[faceNum].p2 && mapFaces[rip].p3 == linkedFaces[faceNum].p3)
-                            {
-                                mapFaces[rip].texture = 3;
-                                break;
-                            }
-                    }
-                    //origin3 = add(mapVectors[i], mul(norm3, OFFSET));
-                    origin3 = add(mapVectors[linkedFaces[faceNum].p1], mul(norm3, OFFSET));
-                    linkedFaces[faceNum].type = -1;
-                    nFinalFaces--;
-                }
-            }
-            while(dot(norm1, cross(norm2, norm3)) == 0);
+mat4 instanceMatrix(meshInstance instance) //scale, then yaw, then move to pos
+{
+    return mat4FromMat3(mat3Scale(mat3RotateZ(instance.yaw), instance.scale), instance.pos);
+}
 
+int placeInstance(mesh m, meshInstance instance, face *outFaces, vec3 *outPoints, int *nOutPoints) //writes the instance's faces and world space vertices to the out arrays, returns the number of faces written
+{
+    int base = *nOutPoints;
+    mat4 transform = instanceMatrix(instance);
+    mat3 turn = mat3RotateZ(instance.yaw);
+    int i;
+    for(i=0;i < m.nVectors;i++)
+        outPoints[base + i] = mat4ApplyPoint(transform, m.vectors[i]);
+    *nOutPoints += m.nVectors;
 
-            d1 = dot(origin1, norm1);
-            d2 = dot(origin2, norm2);
-            d3 = dot(origin3, norm3);
+    for(i=0;i < m.nFaces;i++)
+    {
+        face f = m.faces[i];
+        f.p1 += base;
+        f.p2 += base;
+        f.p3 += base;
+        f.norm = mat3Apply(turn, f.norm);
+        f.mid = mat4ApplyPoint(transform, f.mid);
+        outFaces[i] = f;
+    }
+    return m.nFaces;
+}
 
-            /*
-            vec3 lStart, lNorm;
-            lNorm = unit(cross(norm1, norm2));
+void quicksort(int list[], float ref[], int l, int r)
+{
+    int a=l,b=r;
+    int p = l;
+    int hold;
+    while(p != a || p != b)
+    {
+        while(ref[list[p]] <= ref[list[b]] && p != b)
+            b--;
+        hold = list[b];
+        list[b] = list[p];
+        list[p] = hold;
+        p = b;
+        while(ref[list[p]] >= ref[list[a]] && p != a)
+            a++;
+        hold = list[a];
+        list[a] = list[p];
+        list[p] = hold;
+        p = a;
+    }
+    if(p > l)
+        quicksort(list,ref,l,p-1);
+    if(p < r)
+        quicksort(list,ref,p+1,r);
 
-            float lineX = fabs(lNorm.x);
-            float lineY = fabs(lNorm.y);
-            float lineZ = fabs(lNorm.z);
+}
 
-            if(lineX > lineY && lineX > lineZ)
+/*
+polygon is a face's corners, or the convex polygon it was merged into, textured faces are always just their own triangle
+moves them into view space, clips them to the near plane and projects them onto the screen, nothing here touches the renderer so it can run on any thread
+*/
+void projectFace(int *polygon, int nPolygon, vec3 *points, view *eye, projectedFace *out)
+{
+    vec3 *pointsR = out->pointsR; //rotate and translate points relative to player
+    vec2 *pointsOut = out->pointsOut;
+    vec3 forward = {0,1,0};
+
+    int i;
+    for(i=0;i < nPolygon;i++)
+        pointsR[i] = toView(eye, points[polygon[i]]);
+    int nPoints = 0;
+    bool clipped = false;
+    for(i=0;i < nPolygon;i++)
+    {
+        int next = (i+1) % nPolygon;
+        if(pointsR[i].y >= FRUSTUM_NEAR_LENGTH)
+        {
+            out->from[nPoints] = out->to[nPoints] = i;
+            out->along[nPoints] = 0;
+            pointsOut[nPoints++] = perspective2d(pointsR[i]);
+        }
+        else
+            clipped = true;
+        if((pointsR[i].y >= FRUSTUM_NEAR_LENGTH) != (pointsR[next].y >= FRUSTUM_NEAR_LENGTH))
+        {
+            int front = i, behind = next; //always from the corner in front, so the face on the other side of the edge clips it to the same point
+            if(pointsR[front].y < FRUSTUM_NEAR_LENGTH)
             {
-                lStart.x = 0;
-                float det = norm1.y * norm2.z - norm1.z * norm2.y;
-                lStart.y = (norm2.z * d1 - norm1.z * d2) / det;
-                lStart.z = (norm1.y * d2 - norm2.y * d1) / det;
+                front = next;
+                behind = i;
             }
-            else if(lineY > lineZ)
+            vec3 edge = sub(pointsR[behind], pointsR[front]);
+            float along = dot(sub(mul(forward,FRUSTUM_NEAR_LENGTH),pointsR[front]),forward)/dot(edge,forward);
+            out->from[nPoints] = front;
+            out->to[nPoints] = behind;
+            out->along[nPoints] = along;
+            pointsOut[nPoints++] = perspective2d(add(pointsR[front], mul(edge, along)));
+        }
+    }
+
+    out->nCorners = nPolygon;
+    out->nPoints = nPoints;
+    out->clipped = clipped;
+    if(nPoints == 0) //all of it is behind the near plane
+    {
+        out->onScreen = false;
+        return;
+    }
+
+    int codes[MAX_POLYGON_POINTS + 1];
+    for(i=0;i < nPoints;i++)
+    {
+        codes[i] = 0;
+        if(pointsOut[i].y < 0)
+            codes[i] |= 1;
+        else if(pointsOut[i].y > HEIGHT)
+            codes[i] |= 2;
+        if(pointsOut[i].x > WIDTH)
+            codes[i] |= 4;
+        if(pointsOut[i].x < 0)
+            codes[i] |= 8;
+    }
+
+    int visible = codes[0];
+    for(i=1;i < nPoints;i++) //check if any segment of the polygon is in the view frustum
+        visible &= codes[i];
+
+    out->onScreen = visible == 0;
+}
+
+/*
+fills face f from its projected corners, through spans if it isn't NULL, into indexed instead of the renderer if it isn't NULL
+*/
+void drawFace(face f, projectedFace *p, SDL_Renderer *renderer, SDL_Surface **textures, spanBuffer *spans, indexedFrame *indexed, renderStats *stats)
+{
+    vec2 *pointsOut = p->pointsOut;
+    int nPoints = p->nPoints;
+
+    if(p->onScreen)
+    {
+        stats->facesDrawn++;
+        if(p->clipped)
+            stats->nearClipped++;
+        if((f.flags & 1))
+        {
+            //texture coords of the points out, a corner behind the near plane projects to nonsense so each half of a clipped quad is mapped from the points on screen
+            vec2 uvs[3] = {f.uv1, f.uv2, f.uv3}, uvsOut[4];
+            int i;
+            for(i=0;i < nPoints;i++)
+                uvsOut[i] = add2(uvs[p->from[i]], mul2(sub2(uvs[p->to[i]], uvs[p->from[i]]), p->along[i]));
+            for(i=1;i + 1 < nPoints;i++)
             {
-                lStart.y = 0;
-                float det = norm1.x * norm2.z - norm1.z * norm2.x;
-                lStart.x = (norm2.z * d1 - norm1.z * d2) / det;
-                lStart.z = (norm1.x * d2 - norm2.x * d1) / det;
+                stats->pixelsRasterized += textureTriangle(pointsOut[0], pointsOut[i], pointsOut[i+1], uvsOut[0], uvsOut[i], uvsOut[i+1], renderer, textures[f.texture], f.texture, spans, indexed);
+                stats->trianglesRasterized++;
             }
-            else
+        }
+        else if(p->nCorners > 3) //a merged polygon is filled in one go, and counted as one triangle
+        {
+            stats->pixelsRasterized += fillPolygon(pointsOut, nPoints, renderer, spans, indexed);
+            stats->trianglesRasterized++;
+        }
+        else
+        {
+            stats->pixelsRasterized += fillTriangle(pointsOut[0], pointsOut[1], pointsOut[2], renderer, spans, indexed);
+            stats->trianglesRasterized++;
+            if(nPoints == 4)
             {
-                lStart.z = 0;
-                float det = norm1.x * norm2.y - norm1.y * norm2.x;
-                lStart.x = (norm2.z * d1 - norm1.z * d2) / det;
-                lStart.y = (norm1.x * d2 - norm2.x * d1) / det;
+                stats->pixelsRasterized += fillTriangle(pointsOut[0], pointsOut[2], pointsOut[3], renderer, spans, indexed);
+                stats->trianglesRasterized++;
+                if(DRAW_EDGES == 2 && !spans) //shows where the clipped triangle was split
+                {
+                    SDL_SetRenderDrawColor(renderer, 50,50,50,SDL_ALPHA_OPAQUE);
+                    if(indexed)
+                        indexed->colour = INDEXED_EDGE_GREY;
+                    stats->pixelsRasterized += drawClippedLine(pointsOut[0], pointsOut[2], renderer, indexed);
+                }
+                //SDL_RenderDrawLine(renderer, pointsOut[0].x + (float)WIDTH/2, pointsOut[0].y + (float)HEIGHT/2, pointsOut[2].x + (float)WIDTH/2, pointsOut[2].y + (float)HEIGHT/2);
             }
+        }
 
-            printf("%d %d %d %0.4f %0.4f %0.4f\n", i, nLinkedFaces, nFinalFaces, d1, d2, dot(lNorm, norm3));
 
-            if(i == 14 || i == 15)
-            {
-                printf("%0.3f %0.3f %0.3f   ", lNorm.x, lNorm.y, lNorm.z);
-                printf("%0.3f %0.3f %0.3f   ", norm1.x, norm1.y, norm1.z);
-                printf("%0.3f %0.3f %0.3f\n", norm2.x, norm2.y, norm2.z);
-            }
+        if(DRAW_EDGES && !spans) //lines would be drawn over closer faces when going front to back
+        {
+            SDL_SetRenderDrawColor(renderer, 0,0,0,SDL_ALPHA_OPAQUE);
+            if(indexed)
+                indexed->colour = INDEXED_BLACK;
+            stats->pixelsRasterized += drawWireframePolygon(pointsOut, nPoints, renderer, indexed);
+        }
+    }
 
-            if(dot(lNorm, norm3) != 0)
-                clipVectors[i] = add(lStart, mul(lNorm, (d3 - dot(lStart, norm3)) / dot(lNorm, norm3)));
-            else
-                clipVectors[i] = mapVectors[i];
 
-            */
 
+}
 
-            float det = dot(norm1, cross(norm2, norm3));
+void swapVec2Ptr(vec2 **p1, vec2 **p2)
+{
+    vec2 *hold = *p1;
+    *p1 = *p2;
+    *p2 = hold;
+}
 
-            //printf("%d %f %d %d %0.4f %0.4f %0.4f\n", i, det, nLinkedFaces, nFinalFaces, length(norm1), length(norm2), length(norm3));
+int texelFormat(SDL_Surface *texture) //which row kernels can read the texture, -1 if none of them can
+{
+    if(texture->format->BytesPerPixel == 1 && texture->format->palette)
+        return TEXEL_PALETTED;
+    if(texture->format->BytesPerPixel == 3)
+        return TEXEL_RGB24;
+    if(texture->format->BytesPerPixel == 4)
+        return TEXEL_RGB32;
+    return -1;
+}
 
-            if(i == 14 && i == 15 && false)
-            {
-                printf("%0.3f %0.3f %0.3f   ", norm1.x, norm1.y, norm1.z);
-                printf("%0.3f %0.3f %0.3f   ", norm2.x, norm2.y, norm2.z);
-                printf("%0.3f %0.3f %0.3f\n", norm3.x, norm3.y, norm3.z);
-            }
+#if SDL_BYTEORDER == SDL_LIL_ENDIAN //24 bit texels are put together in the byte order the format's masks are for
+#define TEXEL24(p) ((p)[0] | (p)[1] << 8 | (p)[2] << 16)
+#else
+#define TEXEL24(p) ((p)[0] << 16 | (p)[1] << 8 | (p)[2])
+#endif
 
+/*
+makes a textured row kernel, one is made for each texture format and what it's drawn into so nothing in the loop is decided per pixel
+each pixel is sampled at its centre, FETCH reads the nearest texel at p into texel, WRITE puts it at x and FINISH is done once the row is
+texture coords on the edge of a triangle can land a little outside the texture so they're clamped to the edge
+*/
+#define TEXTURED_ROW(name, bytes, FETCH, WRITE, FINISH) \
+void name(textureRaster *t, int y, int x1, int x2) \
+{ \
+    double rowX = t->mB * (y + 0.5 - t->origin.y), rowY = t->mD * (y + 0.5 - t->origin.y); \
+    int x; \
+    t->runStart = x1; \
+    for(x=x1;x <= x2;x++) \
+    { \
+        float vx = t->mA * (x + 0.5 - t->origin.x) + rowX; /*triangle leg coords*/ \
+        float vy = t->mC * (x + 0.5 - t->origin.x) + rowY; \
+        vec2 tPoint = add2(add2(mul2(t->tU, vx), mul2(t->tV, vy)), t->tOrigin); \
+        Uint8 *p = t->pixels + (int)clamp(tPoint.y + 0.5f, 0, t->maxY) * t->pitch + (int)clamp(tPoint.x + 0.5f, 0, t->maxX) * bytes; \
+        FETCH; \
+        WRITE; \
+    } \
+    FINISH; \
+}
 
-            if(det != 0) //if two of the planes being used were too similar in orientation, det would be too small and cause division overflow
-                clipVectors[i] = mul(add(mul(cross(norm2, norm3),d1), add(mul(cross(norm3, norm1),d2), mul(cross(norm1, norm2),d3))), 1.0/det);
-            //else
-                //clipVectors[i] = mapVectors[i];
+/*
+the renderer can't be handed a row of different colours in one call, so its kernels gather runs of the same colour and draw each as a line
+a texture stretched over the screen comes out as two calls a texel instead of two a pixel, but shrunk ones still change colour nearly every pixel
+the indexed framebuffer writes memory directly and doesn't have this problem, it's the fast path for paletted textures
+*/
+#define RUN_PIXEL(COLOUR) \
+    Uint32 colour = COLOUR; \
+    if(x > t->runStart && colour != t->runColour) \
+    { \
+        drawRun(t, y, x - 1); \
+        t->runStart = x; \
+    } \
+    t->runColour = colour
+
+#define RGB_COLOUR(texel) (0xff000000 | ((texel & t->rMask) >> t->rShift) << 16 | ((texel & t->gMask) >> t->gShift) << 8 | (texel & t->bMask) >> t->bShift)
+
+TEXTURED_ROW(texturedRowPalettedRenderer, 1, Uint8 texel = *p,
+             RUN_PIXEL((Uint32)t->palette[texel].a << 24 | t->palette[texel].r << 16 | t->palette[texel].g << 8 | t->palette[texel].b), drawRun(t, y, x2))
+TEXTURED_ROW(texturedRowPalettedIndexed, 1, Uint8 texel = *p,
+             t->indexed->pixels[y * t->indexed->width + x] = t->remap[texel], (void)0)
+TEXTURED_ROW(texturedRowRGB24Renderer, 3, Uint32 texel = TEXEL24(p),
+             RUN_PIXEL(RGB_COLOUR(texel)), drawRun(t, y, x2))
+TEXTURED_ROW(texturedRowRGB32Renderer, 4, Uint32 texel = *(Uint32 *)p,
+             RUN_PIXEL(RGB_COLOUR(texel)), drawRun(t, y, x2))
+
+void drawRun(textureRaster *t, int y, int x2) //draws the run from t->runStart to x2 in t->runColour
+{
+    SDL_SetRenderDrawColor(t->renderer, t->runColour >> 16 & 255, t->runColour >> 8 & 255, t->runColour & 255, t->runColour >> 24);
+    if(x2 == t->runStart)
+        SDL_RenderDrawPoint(t->renderer, x2, y);
+    else
+        SDL_RenderDrawLine(t->renderer, t->runStart, y, x2, y);
+}
+
+static const textureRowFunction texturedRows[TEXEL_FORMATS][2] = //by texture format, then whether it's drawn into the indexed frame, which only has room for paletted textures' colours
+{
+    {texturedRowPalettedRenderer, texturedRowPalettedIndexed},
+    {texturedRowRGB24Renderer, NULL},
+    {texturedRowRGB32Renderer, NULL}
+};
+
+/*
+fills the triangle p1 p2 p3 with texture, uv1 to uv3 are the texture coords at its corners and are mapped linearly across the screen
+the kernel for its format is picked once here and handed whole rows, or the pieces of them the span buffer hasn't covered yet
+when there's nothing to look up it's filled grey like a texture that hasn't loaded, the overdraw view only counts writes
+*/
+int textureTriangle(vec2 p1, vec2 p2, vec2 p3, vec2 uv1, vec2 uv2, vec2 uv3, SDL_Renderer *renderer, SDL_Surface *texture, int textureIndex, spanBuffer *spans, indexedFrame *indexed)
+{
+    vec2 points[3] = {p1, p2, p3};
+    vec2 u = sub2(p2, p1), v = sub2(p3, p1);
+    float det = (u.x * v.y) - (v.x * u.y);
+    if(det == 0)
+        return 0;
+    int format = texelFormat(texture);
+    textureRowFunction row = format >= 0 ? texturedRows[format][indexed != NULL] : NULL;
+    if(!row || (indexed && indexed->overdraw))
+    {
+        SDL_SetRenderDrawColor(renderer, TEXTURE_LOADING_GREY, TEXTURE_LOADING_GREY, TEXTURE_LOADING_GREY, SDL_ALPHA_OPAQUE);
+        if(indexed)
+            indexed->colour = INDEXED_LOADING_GREY;
+        return fillPolygon(points, 3, renderer, spans, indexed);
+    }
 
+    textureRaster t; //screen to the triangle's legs u and v, then along the same legs in the texture
+    t.maxX = texture->w - 1;
+    t.maxY = texture->h - 1;
+    t.mA = v.y / det;
+    t.mB = -v.x / det;
+    t.mC = -u.y / det;
+    t.mD = u.x / det;
+    t.origin = p1;
+    t.tOrigin = uv1;
+    t.tU = sub2(uv2, uv1);
+    t.tV = sub2(uv3, uv1);
+    t.palette = texture->format->palette ? texture->format->palette->colors : NULL;
+    t.remap = indexed ? textureRemap(indexed, textureIndex, texture) : NULL;
+    t.rMask = texture->format->Rmask;
+    t.gMask = texture->format->Gmask;
+    t.bMask = texture->format->Bmask;
+    t.rShift = texture->format->Rshift;
+    t.gShift = texture->format->Gshift;
+    t.bShift = texture->format->Bshift;
+    t.renderer = renderer;
+    t.indexed = indexed;
+
+    //the same pixels fillTriangle would cover
+    polygonScan scan;
+    scanInit(&scan, points, 3);
+    int i, y, x1, x2, written = 0;
+    SDL_LockSurface(texture);
+    t.pixels = texture->pixels;
+    t.pitch = texture->pitch;
+    while(scanRow(&scan, &y, &x1, &x2))
+    {
+        x1 = max(x1, 0);
+        x2 = min(x2, WIDTH - 1);
+        if(x2 < x1)
+            continue;
+        if(!spans)
+        {
+            row(&t, y, x1, x2);
+            written += x2 - x1 + 1;
+            continue;
         }
+        int nPieces = coverSpan(spans, y, x1, x2);
+        for(i=0;i < nPieces;i++)
+        {
+            row(&t, y, spans->pieces[i * 2], spans->pieces[i * 2 + 1]);
+            written += spans->pieces[i * 2 + 1] - spans->pieces[i * 2] + 1;
+        }
+    }
+    SDL_UnlockSurface(texture);
+    return written;
+}
+
+int fillTriangle(vec2 p1, vec2 p2, vec2 p3, SDL_Renderer *renderer, spanBuffer *spans, indexedFrame *indexed)
+{
+    vec2 points[3] = {p1, p2, p3};
+    return fillPolygon(points, 3, renderer, spans, indexed);
+}
+
+/*
+fills a convex polygon a row at a time, a pixel is drawn if its centre is inside, or on a left or top edge
+faces that share an edge walk it from the same snapped corners, so together they cover every pixel along it exactly once and nothing has to be drawn over the seams
+that only holds where they share both ends of it, a corner in the middle of another face's edge can leave pixels along it, which is why the map's T-junctions are split when it's loaded
+*/
+int fillPolygon(vec2 *points, int n, SDL_Renderer *renderer, spanBuffer *spans, indexedFrame *indexed)
+{
+    vec2 snapped[MAX_POLYGON_POINTS + 1];
+    memcpy(snapped, points, n * sizeof(vec2));
+    polygonScan scan;
+    scanInit(&scan, snapped, n);
+    int y, x1, x2, written = 0;
+    while(scanRow(&scan, &y, &x1, &x2))
+        if(x2 >= x1)
+            written += drawSpan(y, x1, x2, renderer, spans, indexed);
+    return written;
+}
 
-        free(linkedFaces);
+void scanInit(polygonScan *s, vec2 *points, int n) //points are snapped to the sub-pixel grid in place
+{
+    int i, top = 0;
+    s->bottom = 0;
+    for(i=0;i < n;i++)
+        points[i] = (vec2){floorf(points[i].x * SUBPIXEL_STEPS + 0.5) / SUBPIXEL_STEPS, floorf(points[i].y * SUBPIXEL_STEPS + 0.5) / SUBPIXEL_STEPS};
+    for(i=1;i < n;i++)
+    {
+        if(points[i].y < points[top].y)
+            top = i;
+        if(points[i].y > points[s->bottom].y)
+            s->bottom = i;
     }
+    s->points = points;
+    s->n = n;
+    s->side[0] = s->side[1] = top;
+    s->y = clamp(ceilf(points[top].y - 0.5), 0, HEIGHT); //rows whose centres are from the top corner down to just above the bottom one
+    s->endY = clamp(ceilf(points[s->bottom].y - 0.5), 0, HEIGHT);
+}
 
+bool scanRow(polygonScan *s, int *y, int *x1, int *x2) //the next row the polygon covers and its first and last pixel, x2 < x1 if none of the row is inside, false once every row has been done
+{
+    if(s->y >= s->endY)
+        return false;
+    float centre = s->y + 0.5;
+    float x[2];
+    int i;
+    for(i=0;i < 2;i++)
+    {
+        int step = i == 0 ? 1 : s->n - 1;
+        vec2 *a = &s->points[s->side[i]], *b = &s->points[(s->side[i] + step) % s->n];
+        while(b->y <= centre && s->side[i] != s->bottom) //move on to the edge this row's centre is on, both sides go downwards so an edge is always worked out from its top corner
+        {
+            s->side[i] = (s->side[i] + step) % s->n;
+            a = b;
+            b = &s->points[(s->side[i] + step) % s->n];
+        }
+        x[i] = a->x + (b->x - a->x) * (centre - a->y) / (b->y - a->y);
+    }
+    *y = s->y++;
+    *x1 = clamp(ceilf(min(x[0], x[1]) - 0.5), -1, WIDTH);
+    *x2 = clamp(ceilf(max(x[0], x[1]) - 0.5), -1, WIDTH) - 1; //a pixel centred exactly on the right edge belongs to the face on the other side of it
+    return true;
 }
 
+int drawSpan(int y, int x1, int x2, SDL_Renderer *renderer, spanBuffer *spans, indexedFrame *indexed) //draws row y from x1 to x2, or only the parts of it not already covered if spans isn't NULL, returns the number of pixels written
+{
+    if(!spans)
+        return drawRow(y, x1, x2, renderer, indexed);
+    int n = coverSpan(spans, y, x1, x2);
+    int i, written = 0;
+    for(i=0;i < n;i++)
+        written += drawRow(y, spans->pieces[i * 2], spans->pieces[i * 2 + 1], renderer, indexed);
+    return written;
+}
 
-void loadConstants(int *w, int *h, float *sens, char *map, float *frustumW, float *frustumN, int *edges, char *fileName)
+int drawRow(int y, int x1, int x2, SDL_Renderer *renderer, indexedFrame *indexed) //x1 to x2 inclusive, into the indexed frame instead of the renderer if there is one, returns the number of pixels written
 {
-    FILE *settingsFile = fopen(fileName, "r");
-    fscanf(settingsFile, "map = %[^\n]\n", map);
-    fscanf(settingsFile, "width = %d\n", w);
-    fscanf(settingsFile, "height = %d\n", h);
-    fscanf(settingsFile, "sensitivity = %f\n", sens);
-    fscanf(settingsFile, "frustum width = %f\n", frustumW);
-    fscanf(settingsFile, "frustum near length = %f\n", frustumN);
-    fscanf(settingsFile, "draw edges = %d", edges);
-    fclose(settingsFile);
+    x1 = max(x1, 0);
+    x2 = min(x2, WIDTH - 1);
+    if(y < 0 || y >= HEIGHT || x2 < x1)
+        return 0;
+    if(indexed)
+        indexedWrite(indexed, y, x1, x2, indexed->colour);
+    else
+        SDL_RenderDrawLine(renderer, x1, y, x2, y);
+    return x2 - x1 + 1;
+}
+
+void spanBufferInit(spanBuffer *b, int width, int height, arena *frameArena)
+{
+    b->width = width;
+    b->height = height;
+    b->rowsLeft = height;
+    b->scratch = frameArena;
+    b->nSpans = arenaAlloc(frameArena, height * sizeof(int));
+    b->capacity = arenaAlloc(frameArena, height * sizeof(int));
+    b->spans = arenaAlloc(frameArena, height * sizeof(int *));
+    b->pieces = arenaAlloc(frameArena, (width + 2) * sizeof(int));
+    int *rows = arenaAlloc(frameArena, height * 8 * sizeof(int)); //room for 4 spans a row to start with
+    int i;
+    for(i=0;i < height;i++)
+    {
+        b->nSpans[i] = 0;
+        b->capacity[i] = 4;
+        b->spans[i] = rows + i * 8;
+    }
+}
+
+/*
+marks x1 to x2 (inclusive) on row y as covered, and puts the pieces of that range which weren't covered before into b->pieces
+returns the number of pieces
+*/
+int coverSpan(spanBuffer *b, int y, int x1, int x2)
+{
+    x1 = max(x1, 0);
+    x2 = min(x2, b->width - 1);
+    if(y < 0 || y >= b->height || x1 > x2)
+        return 0;
+
+    int *row = b->spans[y];
+    int n = b->nSpans[y];
+    int first = 0;
+    while(first < n && row[first * 2 + 1] < x1 - 1) //first span that touches or is after x1
+        first++;
+    int last = first;
+    int nPieces = 0;
+    int x = x1;
+    while(last < n && row[last * 2] <= x2 + 1) //every span from first to last - 1 touches the new one
+    {
+        if(row[last * 2] > x)
+        {
+            b->pieces[nPieces * 2] = x;
+            b->pieces[nPieces * 2 + 1] = min(row[last * 2] - 1, x2);
+            nPieces++;
+        }
+        x = max(x, row[last * 2 + 1] + 1);
+        last++;
+    }
+    if(x <= x2)
+    {
+        b->pieces[nPieces * 2] = x;
+        b->pieces[nPieces * 2 + 1] = x2;
+        nPieces++;
+    }
+    if(nPieces == 0)
+        return 0;
+
+    //replace the spans it touches with one that covers all of them
+    int start = first < last ? min(x1, row[first * 2]) : x1;
+    int end = first < last ? max(x2, row[(last - 1) * 2 + 1]) : x2;
+    int removed = last - first;
+    if(removed == 0 && n == b->capacity[y]) //out of room on this row, move it to a bigger array
+    {
+        int *bigger = arenaAlloc(b->scratch, b->capacity[y] * 4 * sizeof(int));
+        memcpy(bigger, row, n * 2 * sizeof(int));
+        b->spans[y] = row = bigger;
+        b->capacity[y] *= 2;
+    }
+    memmove(row + (first + 1) * 2, row + last * 2, (n - last) * 2 * sizeof(int));
+    row[first * 2] = start;
+    row[first * 2 + 1] = end;
+    b->nSpans[y] = n - removed + 1;
+
+    if(b->nSpans[y] == 1 && start == 0 && end == b->width - 1)
+        b->rowsLeft--;
+    return nPieces;
+}
+
+/*
+colours is the map's, nTextures is how many textures the map has, width and height are the largest the frame will be drawn at
+the palette starts with the fixed entries and the map colours, textures are remapped onto it as they're first drawn
+with overdraw set the palette is a heat map from black for nothing written to white for OVERDRAW_COLOURS - 1 or more writes
+returns false and prints why if the map has more colours than the palette has room for or something couldn't be made
+*/
+bool indexedFrameInit(indexedFrame *f, SDL_Renderer *renderer, int width, int height, colour *colours, int nColours, int nTextures, bool overdraw)
+{
+    memset(f, 0, sizeof(indexedFrame));
+    if(INDEXED_MAP_COLOURS + nColours > 256)
+    {
+        printf("the map has %d colours, the indexed framebuffer only has room for %d\n", nColours, 256 - INDEXED_MAP_COLOURS);
+        return false;
+    }
+    f->width = width;
+    f->height = height;
+    f->nTextures = nTextures;
+    f->pixels = (Uint8 *)malloc(width * height);
+    f->textureRemap = malloc(max(nTextures, 1) * sizeof(*f->textureRemap));
+    f->remapped = (bool *)calloc(max(nTextures, 1), sizeof(bool));
+    f->texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGB888, SDL_TEXTUREACCESS_STREAMING, width, height);
+    if(!f->pixels || !f->textureRemap || !f->remapped || !f->texture)
+    {
+        if(!f->texture)
+            printf("could not make the indexed framebuffer's texture: %s\n", SDL_GetError());
+        else
+            printf("not enough memory for a %dx%d indexed framebuffer\n", width, height);
+        indexedFrameFree(f);
+        return false;
+    }
+
+    f->palette[INDEXED_BLACK] = 0;
+    f->palette[INDEXED_EDGE_GREY] = (50 << 16) | (50 << 8) | 50;
+    f->palette[INDEXED_LOADING_GREY] = (TEXTURE_LOADING_GREY << 16) | (TEXTURE_LOADING_GREY << 8) | TEXTURE_LOADING_GREY;
+    int i;
+    for(i=0;i < nColours;i++)
+        f->palette[INDEXED_MAP_COLOURS + i] = ((Uint32)clamp(colours[i].r, 0, 255) << 16) | ((Uint32)clamp(colours[i].g, 0, 255) << 8) | (Uint32)clamp(colours[i].b, 0, 255);
+    f->nPalette = INDEXED_MAP_COLOURS + nColours;
+
+    f->overdraw = overdraw;
+    if(overdraw) //the palette is full so textures are only ever matched to it, their remaps aren't used anyway
+    {
+        Uint32 heat[OVERDRAW_COLOURS] = {0x000000, 0x0000c0, 0x0080ff, 0x00c000, 0xffff00, 0xff8000, 0xff0000, 0xffffff};
+        for(i=0;i < 256;i++)
+            f->palette[i] = heat[(int)min(i, OVERDRAW_COLOURS - 1)];
+        f->nPalette = 256;
+    }
+
+    f->resolveRow = resolveRowScalar;
+#ifdef HAS_AVX_KERNELS
+    if(SDL_HasAVX2())
+        f->resolveRow = resolveRowAVX2;
+#endif
+    return true;
 }
 
-void drawFilledFaces(face *faces, int nFaces, camera player, vec3 *points, SDL_Renderer *renderer, colour *colours, SDL_Surface **textures)
+void indexedFrameFree(indexedFrame *f)
 {
-    int facesIndex[nFaces]; //index of each visible face
-    int i, nVisible = 0;
-    for(i=0;i < nFaces;i++) //cull faces which are facing away from the player, or are behind the player
-        if((!BACKFACE_CULL_FILL || dot(sub(player.pos, points[faces[i].p1]), faces[i].norm) >= 0)
-            && (rotateX(rotateZ(sub(points[faces[i].p1], player.pos), -player.yaw), -player.pitch).y >= FRUSTUM_NEAR_LENGTH
-            || rotateX(rotateZ(sub(points[faces[i].p2], player.pos), -player.yaw), -player.pitch).y >= FRUSTUM_NEAR_LENGTH
-            || rotateX(rotateZ(sub(points[faces[i].p3], player.pos), -player.yaw), -player.pitch).y >= FRUSTUM_NEAR_LENGTH))
-            facesIndex[nVisible++] = i;
+    free(f->pixels);
+    free(f->textureRemap);
+    free(f->remapped);
+    if(f->texture)
+        SDL_DestroyTexture(f->texture);
+    memset(f, 0, sizeof(indexedFrame));
+}
 
-    if(nVisible > 0)
+/*
+the table from texture i's palette to the frame's, made the first time it's asked for
+colours already in the frame palette are shared, new ones are added while there's room, after that the nearest one is used
+*/
+Uint8 *textureRemap(indexedFrame *f, int i, SDL_Surface *texture)
+{
+    if(f->remapped[i])
+        return f->textureRemap[i];
+    SDL_Palette *palette = texture->format->palette;
+    int j;
+    for(j=0;j < 256;j++)
     {
-        float dist[nFaces];//sort facesIndex based on median depth value of each corner of the triangle after translation and rotation relative to player
-        for(i=0;i < nVisible;i++)
+        if(!palette || j >= palette->ncolors)
         {
-            float L1 = length(rotateX(rotateZ(sub(points[faces[facesIndex[i]].p1], player.pos), -player.yaw), -player.pitch));
-            float L2 = length(rotateX(rotateZ(sub(points[faces[facesIndex[i]].p2], player.pos), -player.yaw), -player.pitch));
-            float L3 = length(rotateX(rotateZ(sub(points[faces[facesIndex[i]].p3], player.pos), -player.yaw), -player.pitch));
-            dist[facesIndex[i]] = (L1 + L2 + L3);//min((L1 + L2 + L3 - min(min(L1, L2), L3) - max(max(L1, L2), L3)), (L1 + L2 + L3)/3.0);
+            f->textureRemap[i][j] = INDEXED_LOADING_GREY;
+            continue;
         }
-
-        quicksort(facesIndex, dist, 0, nVisible-1);
-
-        //fill in order from furthest to closest (painter's algorithm)
-        for(i=nVisible-1;i >= 0;i--)
+        SDL_Color c = palette->colors[j];
+        Uint32 rgb = (c.r << 16) | (c.g << 8) | c.b;
+        int best = nearestPaletteEntry(f->palette, f->nPalette, rgb);
+        if(f->palette[best] != rgb && f->nPalette < 256)
         {
-            if((faces[facesIndex[i]].flags & 1) == 0)
-                SDL_SetRenderDrawColor(renderer, colours[faces[facesIndex[i]].texture].r, colours[faces[facesIndex[i]].texture].g, colours[faces[facesIndex[i]].texture].b, SDL_ALPHA_OPAQUE);
-            transformFace(faces[facesIndex[i]], points, player, renderer, textures);
+            best = f->nPalette++;
+            f->palette[best] = rgb;
         }
-
+        f->textureRemap[i][j] = best;
     }
-
+    f->remapped[i] = true;
+    return f->textureRemap[i];
 }
 
-
-void quicksort(int list[], float ref[], int l, int r)
+int nearestPaletteEntry(Uint32 *palette, int nPalette, Uint32 rgb) //first of the closest entries, by squared distance between the colours
 {
-    int a=l,b=r;
-    int p = l;
-    int hold;
-    while(p != a || p != b)
+    int k, best = 0, bestDistance = -1;
+    for(k=0;k < nPalette && bestDistance != 0;k++)
     {
-        while(ref[list[p]] <= ref[list[b]] && p != b)
-            b--;
-        hold = list[b];
-        list[b] = list[p];
-        list[p] = hold;
-        p = b;
-        while(ref[list[p]] >= ref[list[a]] && p != a)
-            a++;
-        hold = list[a];
-        list[a] = list[p];
-        list[p] = hold;
-        p = a;
+        int dr = (int)((palette[k] >> 16) & 255) - (int)((rgb >> 16) & 255), dg = (int)((palette[k] >> 8) & 255) - (int)((rgb >> 8) & 255), db = (int)(palette[k] & 255) - (int)(rgb & 255);
+        int distance = dr*dr + dg*dg + db*db;
+        if(bestDistance < 0 || distance < bestDistance)
+        {
+            best = k;
+            bestDistance = distance;
+        }
     }
-    if(p > l)
-        quicksort(list,ref,l,p-1);
-    if(p < r)
-        quicksort(list,ref,p+1,r);
-
+    return best;
 }
 
-void transformFace(face f, vec3 *points, camera player, SDL_Renderer *renderer, SDL_Surface **textures) //also fills face
+void resolveIndexedFrame(indexedFrame *f, int width, int height) //expands the top left width x height of the frame into its texture
 {
-    vec3 pointsR[3] = {rotateX(rotateZ(sub(points[f.p1], player.pos), -player.yaw), -player.pitch), //rotate and translate points relative to player
-    rotateX(rotateZ(sub(points[f.p2], player.pos), -player.yaw), -player.pitch),
-    rotateX(rotateZ(sub(points[f.p3], player.pos), -player.yaw), -player.pitch)};
-    vec3 forward = {0,1,0};
+    SDL_Rect area = {0, 0, width, height};
+    void *pixels;
+    int pitch, y;
+    if(SDL_LockTexture(f->texture, &area, &pixels, &pitch) != 0)
+        return;
+    for(y=0;y < height;y++)
+        f->resolveRow(f->pixels + y * f->width, (Uint32 *)((Uint8 *)pixels + y * pitch), f->palette, width);
+    SDL_UnlockTexture(f->texture);
+}
 
+void resolveRowScalar(Uint8 *src, Uint32 *dst, Uint32 *palette, int n)
+{
     int i;
-    int nPoints = 0;
-    vec2 pointsOut[4];
-    for(i=0;i < 3;i++)
-    {
-        if(pointsR[i].y >= FRUSTUM_NEAR_LENGTH)
-            pointsOut[nPoints++] = perspective2d(pointsR[i]);
-        if((pointsR[i].y >= FRUSTUM_NEAR_LENGTH) != (pointsR[(i+1)%3].y >= FRUSTUM_NEAR_LENGTH))
-            pointsOut[nPoints++] = perspective2d(add(pointsR[i], mul(sub(pointsR[(i+1)%3],pointsR[i]), dot(sub(mul(forward,FRUSTUM_NEAR_LENGTH),pointsR[i]),forward)/dot(sub(pointsR[(i+1)%3],pointsR[i]),forward))));
-    }
+    for(i=0;i < n;i++)
+        dst[i] = palette[src[i]];
+}
 
-    int codes[nPoints];
-    for(i=0;i < nPoints;i++)
+#ifdef HAS_AVX_KERNELS
+AVX2_TARGET void resolveRowAVX2(Uint8 *src, Uint32 *dst, Uint32 *palette, int n) //8 pixels at a time, widened to 32 bit indexes and looked up with one gather
+{
+    int i;
+    for(i=0;i + 8 <= n;i += 8)
     {
-        codes[i] = 0;
-        if(pointsOut[i].y < 0)
-            codes[i] |= 1;
-        else if(pointsOut[i].y > HEIGHT)
-            codes[i] |= 2;
-        if(pointsOut[i].x > WIDTH)
-            codes[i] |= 4;
-        if(pointsOut[i].x < 0)
-            codes[i] |= 8;
+        __m256i index = _mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i *)(src + i)));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_i32gather_epi32((int *)palette, index, 4));
     }
+    for(;i < n;i++)
+        dst[i] = palette[src[i]];
+}
+#endif
 
-    int visible = codes[0];
-    for(i=1;i < nPoints;i++) //check if any segment of the polygon is in the view frustum
-        visible &= codes[i];
-
-
-    if(visible == 0)
+int drawIndexedLine(indexedFrame *f, int x1, int y1, int x2, int y2) //Bresenham, both ends included, anything off the frame is skipped, returns the number of pixels written
+{
+    int dx = abs(x2 - x1), dy = -abs(y2 - y1);
+    int stepX = x1 < x2 ? 1 : -1, stepY = y1 < y2 ? 1 : -1;
+    int error = dx + dy;
+    int written = 0;
+    while(true)
     {
-        if((f.flags & 1))
+        if(x1 >= 0 && x1 < WIDTH && y1 >= 0 && y1 < HEIGHT)
         {
-            printf("wew");
-            int furthest = 0;
-            if(pointsR[furthest].y < pointsR[1].y)
-                furthest = 1;
-            if(pointsR[furthest].y < pointsR[2].y)
-                furthest = 2;
-            furthest = 0;
-            vec3 u3d = sub(pointsR[(furthest + 1) % 3], pointsR[furthest]);
-            vec2 u = sub2(perspective2d(pointsR[(furthest + 1) % 3]), perspective2d(pointsR[furthest]));
-            //vec2 u = mul2(sub2(perspective2d(add(unit(u3d),pointsR[furthest])), perspective2d(pointsR[furthest])),length(u3d));
-            vec3 v3d = sub(pointsR[(furthest + 2) % 3], pointsR[furthest]);
-            vec2 v = sub2(perspective2d(pointsR[(furthest + 2) % 3]), perspective2d(pointsR[furthest]));
-            //vec2 v = mul2(sub2(perspective2d(add(unit(v3d),pointsR[furthest])), perspective2d(pointsR[furthest])),length(v3d));//sub2(mul2(perspective2d(unit(v3d)),length(v3d)), perspective2d(pointsR[furthest]));
-
-            float det = (u.x * v.y) - (v.x * u.y);
-            if(det == 0)
-                return;
-
-            printf("laddo %.5f %.5f %.5f %.5f %.5f \n",u.x, u.y, v.x, v.y, det);
-            textureTriangle(pointsOut[0], pointsOut[1], pointsOut[2], renderer, v.y / det, -v.x / det, -u.y / det, u.x / det, perspective2d(pointsR[furthest]), 0, textures[f.texture], f, u3d.y, v3d.y, pointsR[furthest].y);
-
+            indexedWrite(f, y1, x1, x1, f->colour);
+            written++;
         }
-        else
+        if(x1 == x2 && y1 == y2)
+            break;
+        int e2 = error * 2;
+        if(e2 >= dy)
         {
-            fillTriangle(pointsOut[0], pointsOut[1], pointsOut[2], renderer);
-            if(nPoints == 4)
-            {
-                fillTriangle(pointsOut[0], pointsOut[2], pointsOut[3], renderer);
-                if(DRAW_EDGES == 2)
-                    SDL_SetRenderDrawColor(renderer, 50,50,50,SDL_ALPHA_OPAQUE);
-                drawClippedLine(pointsOut[0], pointsOut[2], renderer);
-                //SDL_RenderDrawLine(renderer, pointsOut[0].x + (float)WIDTH/2, pointsOut[0].y + (float)HEIGHT/2, pointsOut[2].x + (float)WIDTH/2, pointsOut[2].y + (float)HEIGHT/2);
-            }
+            error += dy;
+            x1 += stepX;
         }
-
-
-        if(DRAW_EDGES)
+        if(e2 <= dx)
         {
-            SDL_SetRenderDrawColor(renderer, 0,0,0,SDL_ALPHA_OPAQUE);
-            drawWireframePolygon(pointsOut, nPoints, renderer);
+            error += dx;
+            y1 += stepY;
         }
     }
-
-
-
+    return written;
 }
 
-void swapVec2Ptr(vec2 **p1, vec2 **p2)
+void indexedWrite(indexedFrame *f, int y, int x1, int x2, Uint8 index) //x1 to x2 inclusive of row y, which has to be on the frame, in the overdraw view each pixel is counted up instead
 {
-    vec2 *hold = *p1;
-    *p1 = *p2;
-    *p2 = hold;
+    Uint8 *row = f->pixels + y * f->width;
+    if(!f->overdraw)
+    {
+        memset(row + x1, index, x2 - x1 + 1);
+        return;
+    }
+    int x;
+    for(x=x1;x <= x2;x++)
+        if(row[x] < 255)
+            row[x]++;
 }
 
-void textureTriangle(vec2 p1, vec2 p2, vec2 p3, SDL_Renderer *renderer, float mA, float mB, float mC, float mD, vec2 origin, int furthest, SDL_Surface *texture, face f, float uz, float vz, float oz)
+void occlusionInit(occlusionBuffer *o, int width, int height, arena *frameArena) //width and height are the screen's, the buffer is made OCCLUSION_WIDTH wide with the same shape
 {
-    vec2 *top = &p1;
-    vec2 *mid = &p2;
-    vec2 *bot = &p3;
-
-    vec2 uvs[3] = {f.uv1, f.uv2, f.uv3};
-    vec2 tOrigin  = uvs[furthest];
-    vec2 tU = sub2(uvs[(furthest + 1) % 3], tOrigin);
-    vec2 tV = sub2(uvs[(furthest + 2) % 3], tOrigin);
-    printf("2 %.5f %.5f\n", tU.x, tU.y);
-    printf("2 %.5f %.5f\n", tV.x, tV.y);
-    //SDL_Delay(5000);
-    //sort by y value
-
-    if(top->y > bot->y)
-        swapVec2Ptr(&top,&bot);
-    if(top->y > mid->y)
-        swapVec2Ptr(&top,&mid);
-    if(mid->y > bot->y)
-        swapVec2Ptr(&mid,&bot);
-
-    vec2 mid2 = {.x = (bot->x - top->x) * (mid->y - top->y) / (bot->y - top->y) + top->x, .y = mid->y};
-    SDL_LockSurface(texture);
-    printf("nice\n");
-    if(mid->y != top->y) //draw flat bottom triangle
+    o->scale = (float)OCCLUSION_WIDTH / width;
+    o->width[0] = OCCLUSION_WIDTH;
+    o->height[0] = max(height * o->scale + 0.5, 1);
+    o->nLevels = 1;
+    while(o->nLevels < OCCLUSION_LEVELS && (o->width[o->nLevels - 1] > 1 || o->height[o->nLevels - 1] > 1))
     {
-        float starty = max(top->y, 0); //top
-        float endy = min(mid->y, HEIGHT); //bottom
-
-        float slope1 = (mid->x - top->x) / (mid->y - top->y);
-        float slope2 = (mid2.x - top->x) / (mid2.y - top->y);
-
-        float x1 = top->x + (slope1 * (starty - top->y));
-        float x2 = top->x + (slope2 * (starty - top->y));
-
-        float x;
-        float y;
-        int inc;
-        for(y = starty;y <= endy;y++)
-        {
-            //printf("1");
-            inc = (x1 < x2) ? 1 : -1;
-            if(!((x1 >= 0 || x2 >= 0) && (x1 <= WIDTH || x2 <= WIDTH)))
-                continue;
-            //    SDL_RenderDrawLine(renderer, clamp(min(x1,x2),0,WIDTH) - 1, y + 0.5f, clamp(max(x1,x2),0,WIDTH) + 1, y + 0.5f);
-            for(x = x1;(x2 - x)*inc >= 0;x += inc)
-            {
-                float vx = mA * (x - origin.x) + mB * (y - origin.y); //triangle leg coords
-                float vy = mC * (x - origin.x) + mD * (y - origin.y);
-                //printf("4  %.5f %.5f %.5f %.5f  ", mA, mB, mC, mD);
-                vec2 tPoint = add2(add2(mul2(tU, vx), mul2(tV, vy)), tOrigin);
-                //printf("%.5f %.5f %.5f %.5f\n", vx, vy, tPoint.x, tPoint.y);
-                Uint8 index = *((Uint8 *)texture->pixels + (int)(tPoint.y + 0.5f) * texture->pitch + (int)(tPoint.x + 0.5f) * texture->format->BytesPerPixel);
-                //printf("\n3");
-                //printf("%d\n", texture->format->BitsPerPixel);
-                //SDL_Delay(5000);
-
-                //printf("\n4");
-
-                //SDL_PixelFormat *fmt = texture->format;
-                //SDL_SetRenderDrawColor(renderer, index & fmt->Rmask >> fmt->Rshift << fmt->Rloss, index & fmt->Gmask >> fmt->Gshift << fmt->Gloss, index & fmt->Bmask >> fmt->Bshift << fmt->Bloss, index & fmt->Amask >> fmt->Ashift << fmt->Aloss);
-                SDL_Color *color = &(texture->format->palette->colors[index]);
-                SDL_SetRenderDrawColor(renderer, color->r, color->g, color->b, color->a);
-                SDL_RenderDrawPoint(renderer, x, y);
-                //SDL_RenderPresent(renderer);
-                //SDL_Delay(1);
-            }
+        o->width[o->nLevels] = (o->width[o->nLevels - 1] + 1) / 2;
+        o->height[o->nLevels] = (o->height[o->nLevels - 1] + 1) / 2;
+        o->nLevels++;
+    }
+    int i;
+    for(i=0;i < o->nLevels;i++)
+        o->depth[i] = arenaAlloc(frameArena, o->width[i] * o->height[i] * sizeof(float));
+    for(i=0;i < o->width[0] * o->height[0];i++)
+        o->depth[0][i] = INFINITY;
+}
 
-            x1 += slope1;
-            x2 += slope2;
-            //SDL_RenderPresent(renderer);
-        }
+/*
+draws a convex polygon given in camera space into the bottom level of the buffer, n is at most MAX_POLYGON_POINTS
+only texels the polygon covers completely are written, with the furthest depth it reaches inside the texel, so the buffer never claims anything is nearer than it is
+1/depth and the edge functions are linear across the screen, so both are worst at one of a texel's corners, and which one only depends on the signs of their gradients
+*/
+void occlusionDrawPolygon(occlusionBuffer *o, vec3 *pointsR, int n)
+{
+    int i;
+    for(i=0;i < n;i++)
+        if(pointsR[i].y < FRUSTUM_NEAR_LENGTH) //polygons crossing the near plane are left out rather than clipped
+            return;
+    vec2 p[MAX_POLYGON_POINTS], low = {INFINITY, INFINITY}, high = {-INFINITY, -INFINITY};
+    float w[MAX_POLYGON_POINTS];
+    float area = 0; //twice the area, signed by the winding on screen
+    for(i=0;i < n;i++)
+    {
+        p[i] = mul2(perspective2d(pointsR[i]), o->scale);
+        w[i] = 1 / pointsR[i].y;
+        low.x = min(low.x, p[i].x); low.y = min(low.y, p[i].y);
+        high.x = max(high.x, p[i].x); high.y = max(high.y, p[i].y);
     }
-    printf("meme");
-    if(mid->y != bot->y) //draw flat top triangle
+    for(i=0;i < n;i++)
+        area += cross2(p[i], p[(i+1)%n]);
+    if(fabs(area) < OCCLUDER_MIN_AREA * 2)
+        return;
+    //the plane of 1/depth from the last two points and the first, which are always one of the original triangles or corners of a convex polygon in one plane
+    vec2 d1 = sub2(p[n-2], p[0]), d2 = sub2(p[n-1], p[0]);
+    float det = cross2(d1, d2);
+    if(det == 0)
+        return;
+    float dwdx = ((w[n-2] - w[0]) * d2.y - (w[n-1] - w[0]) * d1.y) / det;
+    float dwdy = ((w[n-1] - w[0]) * d1.x - (w[n-2] - w[0]) * d2.x) / det;
+
+    float edgeX[MAX_POLYGON_POINTS], edgeY[MAX_POLYGON_POINTS], edge[MAX_POLYGON_POINTS]; //edge i is edgeX * x + edgeY * y + edge, positive inside
+    float side = area > 0 ? 1 : -1;
+    for(i=0;i < n;i++)
     {
-        float starty = max(mid->y, 0);
-        float endy = min(bot->y, HEIGHT);
-
-        float slope1 = (bot->x - mid->x) / (bot->y - mid->y);
-        float slope2 = (bot->x - mid2.x) / (bot->y - mid2.y);
-
-        float x1 = mid->x + (slope1 * (starty - mid->y));
-        float x2 = mid2.x + (slope2 * (starty - mid->y));
+        vec2 d = sub2(p[(i+1)%n], p[i]);
+        edgeX[i] = -d.y * side;
+        edgeY[i] = d.x * side;
+        edge[i] = (d.y * p[i].x - d.x * p[i].y) * side + min(edgeX[i], 0) + min(edgeY[i], 0); //moved to the texel corner nearest the outside
+    }
 
-        float x;
-        float y;
-        int inc;
-        for(y = starty;y <= endy;y++)
+    int x1 = max(floor(low.x), 0), x2 = min(ceil(high.x), o->width[0]) - 1;
+    int y1 = max(floor(low.y), 0), y2 = min(ceil(high.y), o->height[0]) - 1;
+    int x, y;
+    for(y=y1;y <= y2;y++)
+        for(x=x1;x <= x2;x++)
         {
-            inc = (x1 < x2) ? 1 : -1;
-            //if((x1 >= 0 || x2 >= 0) && (x1 <= WIDTH || x2 <= WIDTH))
-            //    SDL_RenderDrawLine(renderer, clamp(min(x1,x2),0,WIDTH) - 1, y + 0.5f, clamp(max(x1,x2),0,WIDTH) + 1, y + 0.5f);
-            if(!((x1 >= 0 || x2 >= 0) && (x1 <= WIDTH || x2 <= WIDTH)))
+            bool inside = true;
+            for(i=0;i < n && inside;i++)
+                inside = edgeX[i] * x + edgeY[i] * y + edge[i] >= 0;
+            if(!inside)
                 continue;
-            for(x = x1;(x2 - x)*inc >= 0;x += inc)
+            float wFar = w[0] + dwdx * (x - p[0].x) + dwdy * (y - p[0].y) + min(dwdx, 0) + min(dwdy, 0);
+            float *texel = &o->depth[0][y * o->width[0] + x];
+            *texel = min(*texel, 1 / wFar);
+        }
+}
+
+void occlusionBuildPyramid(occlusionBuffer *o)
+{
+    int level, x, y;
+    for(level=1;level < o->nLevels;level++)
+    {
+        float *below = o->depth[level - 1];
+        int w = o->width[level - 1], h = o->height[level - 1];
+        for(y=0;y < o->height[level];y++)
+            for(x=0;x < o->width[level];x++)
             {
-                float vx = mA * (x - origin.x) + mB * (y - origin.y); //triangle leg coords
-                float vy = mC * (x - origin.x) + mD * (y - origin.y);
-
-                vec2 tPoint = add2(add2(mul2(tU, vx), mul2(tV, vy)), tOrigin);
-                Uint8 index = *((Uint8 *)texture->pixels + (int)(tPoint.y + 0.5f) * texture->pitch + (int)(tPoint.x + 0.5f) * texture->format->BytesPerPixel);
-                SDL_Color *color = &texture->format->palette->colors[index];
-                SDL_SetRenderDrawColor(renderer, color->r, color->g, color->b, color->a);
-                SDL_RenderDrawPoint(renderer, x, y);
+                int x1 = x*2, y1 = y*2, x2 = min(x*2 + 1, w - 1), y2 = min(y*2 + 1, h - 1);
+                o->depth[level][y * o->width[level] + x] = max(max(below[y1*w + x1], below[y1*w + x2]), max(below[y2*w + x1], below[y2*w + x2]));
             }
-
-            x1 += slope1;
-            x2 += slope2;
-        }
     }
-    SDL_UnlockSurface(texture);
-    //SDL_RenderDrawLine(renderer, mid->x, mid->y, mid2.x, mid2.y);
-    //SDL_RenderDrawLine(renderer, top->x , top->y + 0.5f, mid->x, mid->y + 0.5f);
-    //SDL_RenderDrawLine(renderer, top->x, top->y + 0.5f, bot->x, bot->y + 0.5f);
-    //SDL_RenderDrawLine(renderer, bot->x, bot->y + 0.5f, mid->x, mid->y + 0.5f);
-    //drawClippedLine(p1, p2, renderer);
-    //drawClippedLine(p1, p3, renderer);
-    //drawClippedLine(p3, p2, renderer);
 }
 
-void fillTriangle(vec2 p1, vec2 p2, vec2 p3, SDL_Renderer *renderer)
+/*
+true if the points given in world space, and everything between them, are hidden behind what's in the buffer
+the rectangle they cover on screen is tested at the level where it's at most 4 texels across, against the nearest of the points
+*/
+bool occluded(occlusionBuffer *o, vec3 *corners, int n, view *eye)
 {
-    vec2 *top = &p1;
-    vec2 *mid = &p2;
-    vec2 *bot = &p3;
-
-    //sort by y value
-
-    if(top->y > bot->y)
-        swapVec2Ptr(&top,&bot);
-    if(top->y > mid->y)
-        swapVec2Ptr(&top,&mid);
-    if(mid->y > bot->y)
-        swapVec2Ptr(&mid,&bot);
-
-    vec2 mid2 = {.x = (bot->x - top->x) * (mid->y - top->y) / (bot->y - top->y) + top->x, .y = mid->y};
-
-    if(mid->y != top->y) //draw flat bottom triangle
+    float nearest = INFINITY;
+    vec2 low = {INFINITY, INFINITY}, high = {-INFINITY, -INFINITY};
+    int i;
+    for(i=0;i < n;i++)
     {
-        float starty = max(top->y, 0); //top
-        float endy = min(mid->y, HEIGHT); //bottom
-
-        float slope1 = (mid->x - top->x) / (mid->y - top->y);
-        float slope2 = (mid2.x - top->x) / (mid2.y - top->y);
-
-        float x1 = top->x + (slope1 * (starty - top->y));
-        float x2 = top->x + (slope2 * (starty - top->y));
-
-        float y;
-        for(y = starty;y <= endy;y++)
-        {
-            if((x1 >= 0 || x2 >= 0) && (x1 <= WIDTH || x2 <= WIDTH))
-                SDL_RenderDrawLine(renderer, clamp(min(x1,x2),0,WIDTH) - 1, y + 0.5f, clamp(max(x1,x2),0,WIDTH) + 1, y + 0.5f);
-            x1 += slope1;
-            x2 += slope2;
-            //SDL_RenderPresent(renderer);
-        }
+        vec3 r = toView(eye, corners[i]);
+        if(r.y < FRUSTUM_NEAR_LENGTH) //too close to say where it is on screen
+            return false;
+        vec2 p = mul2(perspective2d(r), o->scale);
+        nearest = min(nearest, r.y);
+        low.x = min(low.x, p.x); low.y = min(low.y, p.y);
+        high.x = max(high.x, p.x); high.y = max(high.y, p.y);
     }
-
-    if(mid->y != bot->y) //draw flat top triangle
+    if(high.x < 0 || high.y < 0 || low.x >= o->width[0] || low.y >= o->height[0])
+        return false;
+    int x1 = max(floor(low.x), 0), x2 = min(floor(high.x), o->width[0] - 1);
+    int y1 = max(floor(low.y), 0), y2 = min(floor(high.y), o->height[0] - 1);
+    int level = 0;
+    while(level + 1 < o->nLevels && (x2 - x1 > 3 || y2 - y1 > 3))
     {
-        float starty = max(mid->y, 0);
-        float endy = min(bot->y, HEIGHT);
-
-        float slope1 = (bot->x - mid->x) / (bot->y - mid->y);
-        float slope2 = (bot->x - mid2.x) / (bot->y - mid2.y);
-
-        float x1 = mid->x + (slope1 * (starty - mid->y));
-        float x2 = mid2.x + (slope2 * (starty - mid->y));
-
-        float y;
-        for(y = starty;y <= endy;y++)
-        {
-            if((x1 >= 0 || x2 >= 0) && (x1 <= WIDTH || x2 <= WIDTH))
-                SDL_RenderDrawLine(renderer, clamp(min(x1,x2),0,WIDTH), y + 0.5f, clamp(max(x1,x2),0,WIDTH) + 1, y + 0.5f);
-            x1 += slope1;
-            x2 += slope2;
-            //SDL_RenderPresent(renderer);
-        }
+        x1 >>= 1; x2 >>= 1; y1 >>= 1; y2 >>= 1;
+        level++;
     }
-
-    //SDL_RenderDrawLine(renderer, mid->x, mid->y, mid2.x, mid2.y);
-    //SDL_RenderDrawLine(renderer, top->x , top->y + 0.5f, mid->x, mid->y + 0.5f);
-    //SDL_RenderDrawLine(renderer, top->x, top->y + 0.5f, bot->x, bot->y + 0.5f);
-    //SDL_RenderDrawLine(renderer, bot->x, bot->y + 0.5f, mid->x, mid->y + 0.5f);
-    drawClippedLine(p1, p2, renderer);
-    drawClippedLine(p1, p3, renderer);
-    drawClippedLine(p3, p2, renderer);
+    int x, y;
+    for(y=y1;y <= y2;y++)
+        for(x=x1;x <= x2;x++)
+            if(nearest <= o->depth[level][y * o->width[level] + x] * OCCLUSION_BIAS)
+                return false;
+    return true;
 }
 
-void drawWireframePolygon(vec2 *polygon, int nPoints, SDL_Renderer *renderer)
+void boxCorners(vec3 centre, float radius, vec3 *corners) //corners of the cube around a sphere
 {
     int i;
+    for(i=0;i < 8;i++)
+    {
+        vec3 corner = {centre.x + (i & 1 ? radius : -radius), centre.y + (i & 2 ? radius : -radius), centre.z + (i & 4 ? radius : -radius)};
+        corners[i] = corner;
+    }
+}
+
+int drawWireframePolygon(vec2 *polygon, int nPoints, SDL_Renderer *renderer, indexedFrame *indexed) //returns the number of pixels written
+{
+    int i, written = 0;
     for(i=0;i < nPoints;i++)
-        drawClippedLine(polygon[i], polygon[(i+1)%nPoints], renderer);
+        written += drawClippedLine(polygon[i], polygon[(i+1)%nPoints], renderer, indexed);
         //SDL_RenderDrawLine(renderer, polygon[i].x + WIDTH/2, polygon[i].y + HEIGHT/2, polygon[(i+1)%nPoints].x + WIDTH/2, polygon[(i+1)%nPoints].y + HEIGHT/2);
+    return written;
 }
 
 int getClipCode(vec2 a) //up 1, down 2, right 4, left 8
@@ -1023,7 +5446,7 @@ int getClipCode(vec2 a) //up 1, down 2, right 4, left 8
     return out;
 }
 
-void drawClippedLine(vec2 a, vec2 b, SDL_Renderer *renderer) //up 1, down 2, right 4, left 8
+int drawClippedLine(vec2 a, vec2 b, SDL_Renderer *renderer, indexedFrame *indexed) //up 1, down 2, right 4, left 8, returns the number of pixels written
 {
     bool found = false, valid = false;
     int codeA = getClipCode(a);
@@ -1076,47 +5499,24 @@ void drawClippedLine(vec2 a, vec2 b, SDL_Renderer *renderer) //up 1, down 2, rig
         }
     }
 
-    if(valid)
+    if(valid && indexed)
+        return drawIndexedLine(indexed, a.x, a.y + 0.5f, b.x, b.y + 0.5f);
+    else if(valid)
+    {
         SDL_RenderDrawLine(renderer, a.x, a.y + 0.5f, b.x, b.y + 0.5f);
-
-}
-
-bool clipVelocity(camera *player, face triangle, vec3 *points)
-{
-    float e = 0.001;
-    if(dot(triangle.norm, player->vel) >= 0)
-        return false;
-    float d = dot(sub(points[triangle.p1], player->pos), triangle.norm) / dot(player->vel, triangle.norm);
-
-    if(d >= 1 || d < -e)
-        return false;
-
-    vec3 intersect = add(player->pos, mul(player->vel, d));
-    vec3 t2 = sub(points[triangle.p2], points[triangle.p1]);
-    vec3 t3 = sub(points[triangle.p3], points[triangle.p1]);
-    vec3 w = sub(intersect, points[triangle.p1]);
-
-    float bot = dot(t2, t3);
-    bot *= bot;
-    bot -= dot(t2, t2) * dot(t3, t3);
-
-    float u = ((dot(t2, t3) * dot(w, t2)) - (dot(t2, t2) * dot(w, t3))) / bot;
-    float v = ((dot(t2, t3) * dot(w, t3)) - (dot(t3, t3) * dot(w, t2))) / bot;
-
-    if(v < -e || v > 1.0 + e || u < -e || u > 1.0 + e || u + v > 1.0 + e)
-        return false;
-
-    player->vel = sub(player->vel, mul(triangle.norm, dot(triangle.norm, mul(player->vel, 1.0 - d)) -e));
-    return true;
+        return max(abs((int)a.x - (int)b.x), abs((int)(a.y + 0.5f) - (int)(b.y + 0.5f))) + 1;
+    }
+    return 0;
 }
 
-void drawWireframeFace(face f, camera player, vec3 *points, SDL_Renderer *render)
+void drawWireframeFace(faceTable *faces, int i, view *eye, vec3 *points, SDL_Renderer *render)
 {
-    if(!BACKFACE_CULL_WIREFRAME || dot(sub(player.pos, points[f.p1]), f.norm) >= 0) //if backface culling is enabled, only draw if the face is facing towards the player
+    int *p = &faces->indices[i*3];
+    if(!BACKFACE_CULL_WIREFRAME || dot(eye->pos, faceNormal(faces, i)) - faces->planes[i*4 + 3] >= 0) //if backface culling is enabled, only draw if the face is facing towards the player
     {
-        vec3 p1R = rotateX(rotateZ(sub(points[f.p1], player.pos), -player.yaw), -player.pitch); //rotate and translate points relative to player
-        vec3 p2R = rotateX(rotateZ(sub(points[f.p2], player.pos), -player.yaw), -player.pitch);
-        vec3 p3R = rotateX(rotateZ(sub(points[f.p3], player.pos), -player.yaw), -player.pitch);
+        vec3 p1R = toView(eye, points[p[0]]); //rotate and translate points relative to player
+        vec3 p2R = toView(eye, points[p[1]]);
+        vec3 p3R = toView(eye, points[p[2]]);
 
         drawLine(p1R,p2R,render); //draw the 3 lines that make up the triangle face
         drawLine(p2R,p3R,render);
@@ -1233,137 +5633,6 @@ float clamp(float a, float bot, float top)
     return min(max(bot, a), top);
 }
 
-float length(vec3 a)
-{
-    return sqrt((double)((a.x * a.x) + (a.y * a.y) + (a.z * a.z)));
-}
-
-float dot(vec3 a, vec3 b)
-{
-    return (a.x * b.x) + (a.y * b.y) + (a.z * b.z);
-}
-
-vec3 add(vec3 a, vec3 b)
-{
-    vec3 r = {.x = a.x + b.x, .y = a.y + b.y, .z = a.z + b.z};
-    return r;
-}
-
-vec3 sub(vec3 a, vec3 b)
-{
-    vec3 r = {.x = a.x - b.x, .y = a.y - b.y, .z = a.z - b.z};
-    return r;
-}
-
-vec3 mul(vec3 a, float b)
-{
-    vec3 r = {.x = a.x * b, .y = a.y * b, .z = a.z * b};
-    return r;
-}
-
-vec3 unit(vec3 a)
-{
-    float len = length(a);
-    vec3 r = mul(a,(len != 0 ? 1/len : 0));//check for vector length of 0 to prevent divide by zero error
-    return r;
-}
-
-vec3 cross(vec3 a, vec3 b)
-{
-    vec3 r = {.x = (a.y * b.z) - (a.z * b.y), .y = (a.z * b.x) - (a.x * b.z), .z = (a.x * b.y) - (a.y * b.x)};
-    return r;
-}
-
-vec3 rotate(vec3 a, vec3 b, float theta) //rotates vector a theta radians around axis b //TODO: implement the more efficient way of doing this
-{
-    vec3 parallel = mul(unit(a),dot(a,unit(b)));
-    vec3 perpendicular = sub(a,parallel);
-    vec3 r = add(mul(add(mul(unit(perpendicular),cos(theta)),mul(unit(cross(b,perpendicular)),sin(theta))),length(perpendicular)),parallel);
-    return r;
-}
-
-vec3 rotateZ(vec3 a, float theta) //faster version of rotate with z as the axis
-{
-    float sinTheta = sin(theta);
-    float cosTheta = cos(theta);
-
-    vec3 r = {.x = a.x * cosTheta - a.y * sinTheta, .y = a.y * cosTheta + a.x * sinTheta, .z = a.z};
-    return r;
-}
-
-vec3 rotateX(vec3 a, float theta)
-{
-    float sinTheta = sin(theta);
-    float cosTheta = cos(theta);
-
-    vec3 r = {.x = a.x, .y = a.y * cosTheta - a.z * sinTheta, .z = a.z * cosTheta + a.y * sinTheta};
-    return r;
-}
-
-vec3 dropX(vec3 a)
-{
-    vec3 r = {.x = 0, .y = a.y, .z = a.z};
-    return r;
-}
-
-vec3 dropY(vec3 a)
-{
-    vec3 r = {.x = a.x, .y = 0, .z = a.z};
-    return r;
-}
-
-vec3 dropZ(vec3 a)
-{
-    vec3 r = {.x = a.x, .y = a.y, .z = 0};
-    return r;
-}
-
-vec2 add2(vec2 a, vec2 b)
-{
-    vec2 r = {.x = a.x + b.x, .y = a.y + b.y};
-    return r;
-}
-
-vec2 sub2(vec2 a, vec2 b)
-{
-    vec2 r = {.x = a.x - b.x, .y = a.y - b.y};
-    return r;
-}
-
-vec2 mul2(vec2 a, float b)
-{
-    vec2 r = {.x = a.x * b, .y = a.y * b};
-    return r;
-}
-
-float length2(vec2 a)
-{
-    return sqrt((double)((a.x * a.x) + (a.y * a.y)));
-}
-
-float dot2(vec2 a, vec2 b)
-{
-    return (a.x * b.x) + (a.y * b.y);
-}
-
-float cross2(vec2 a, vec2 b) //magnitude of the cross product
-{
-    return (a.x * b.y) - (a.y * b.x);
-}
-
-vec2 unit2(vec2 a)
-{
-    float len = length2(a);
-    vec2 r = mul2(a,(len != 0 ? 1/len : 0));//check for vector length of 0 to prevent divide by zero error
-    return r;
-}
-
-vec3 toVec3(vec2 a, float z)
-{
-    vec3 r = {.x = a.x, .y = a.y, .z = z};
-    return r;
-}
-
 vec2 perspective2d(vec3 a)
 {
 
@@ -0,0 +1,322 @@
+#ifndef VECMATH_H
+#define VECMATH_H
+
+//vector and matrix maths for the renderer and physics, all static inline so the calls in hot loops go away
+//vec3 and vec2 stay plain floats so arrays of them keep the layout maps and the collision table are built around
+//vec4 and mat4 are 16 byte aligned and use SSE when the compiler has it turned on
+
+#include <math.h>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define VECMATH_SSE
+#endif
+
+typedef struct //vec3
+{
+    float x,y,z;
+} vec3;
+
+typedef struct //vec2
+{
+    float x,y;
+} vec2;
+
+typedef union //vec4 //one SSE register
+{
+#ifdef VECMATH_SSE
+    __m128 m;
+#endif
+    float f[4]; //x, y, z, w, named through an array since C99 has no anonymous structs
+} __attribute__((aligned(16))) vec4;
+
+typedef struct //mat3 //rows, so applying one is three dot products
+{
+    vec3 x,y,z;
+} mat3;
+
+typedef struct //mat4 //columns, the last one is the translation
+{
+    vec4 c[4];
+} mat4;
+
+
+static inline float dot(vec3 a, vec3 b)
+{
+    return (a.x * b.x) + (a.y * b.y) + (a.z * b.z);
+}
+
+static inline float length(vec3 a)
+{
+    return sqrtf(dot(a, a));
+}
+
+static inline vec3 add(vec3 a, vec3 b)
+{
+    vec3 r = {.x = a.x + b.x, .y = a.y + b.y, .z = a.z + b.z};
+    return r;
+}
+
+static inline vec3 sub(vec3 a, vec3 b)
+{
+    vec3 r = {.x = a.x - b.x, .y = a.y - b.y, .z = a.z - b.z};
+    return r;
+}
+
+static inline vec3 mul(vec3 a, float b)
+{
+    vec3 r = {.x = a.x * b, .y = a.y * b, .z = a.z * b};
+    return r;
+}
+
+static inline vec3 unit(vec3 a) //sqrtf is correctly rounded everywhere, unlike the SSE rsqrt estimate, and the simulation needs the same result on every CPU for replays
+{
+    float len2 = dot(a, a);
+    return mul(a, len2 != 0 ? 1.0f / sqrtf(len2) : 0); //a zero vector stays zero instead of dividing by zero
+}
+
+static inline vec3 cross(vec3 a, vec3 b)
+{
+    vec3 r = {.x = (a.y * b.z) - (a.z * b.y), .y = (a.z * b.x) - (a.x * b.z), .z = (a.x * b.y) - (a.y * b.x)};
+    return r;
+}
+
+static inline vec3 rotate(vec3 a, vec3 b, float theta) //rotates vector a theta radians around axis b (Rodrigues' formula)
+{
+    vec3 k = unit(b);
+    float c = cosf(theta);
+    return add(add(mul(a, c), mul(cross(k, a), sinf(theta))), mul(k, dot(k, a) * (1 - c)));
+}
+
+static inline vec3 rotateZ(vec3 a, float theta) //faster version of rotate with z as the axis
+{
+    float sinTheta = sinf(theta);
+    float cosTheta = cosf(theta);
+
+    vec3 r = {.x = a.x * cosTheta - a.y * sinTheta, .y = a.y * cosTheta + a.x * sinTheta, .z = a.z};
+    return r;
+}
+
+static inline vec3 rotateX(vec3 a, float theta)
+{
+    float sinTheta = sinf(theta);
+    float cosTheta = cosf(theta);
+
+    vec3 r = {.x = a.x, .y = a.y * cosTheta - a.z * sinTheta, .z = a.z * cosTheta + a.y * sinTheta};
+    return r;
+}
+
+static inline vec3 dropX(vec3 a)
+{
+    vec3 r = {.x = 0, .y = a.y, .z = a.z};
+    return r;
+}
+
+static inline vec3 dropY(vec3 a)
+{
+    vec3 r = {.x = a.x, .y = 0, .z = a.z};
+    return r;
+}
+
+static inline vec3 dropZ(vec3 a)
+{
+    vec3 r = {.x = a.x, .y = a.y, .z = 0};
+    return r;
+}
+
+
+static inline vec2 add2(vec2 a, vec2 b)
+{
+    vec2 r = {.x = a.x + b.x, .y = a.y + b.y};
+    return r;
+}
+
+static inline vec2 sub2(vec2 a, vec2 b)
+{
+    vec2 r = {.x = a.x - b.x, .y = a.y - b.y};
+    return r;
+}
+
+static inline vec2 mul2(vec2 a, float b)
+{
+    vec2 r = {.x = a.x * b, .y = a.y * b};
+    return r;
+}
+
+static inline float dot2(vec2 a, vec2 b)
+{
+    return (a.x * b.x) + (a.y * b.y);
+}
+
+static inline float length2(vec2 a)
+{
+    return sqrtf(dot2(a, a));
+}
+
+static inline float cross2(vec2 a, vec2 b) //magnitude of the cross product
+{
+    return (a.x * b.y) - (a.y * b.x);
+}
+
+static inline vec2 unit2(vec2 a)
+{
+    float len2 = dot2(a, a);
+    return mul2(a, len2 != 0 ? 1.0f / sqrtf(len2) : 0);
+}
+
+static inline vec3 toVec3(vec2 a, float z)
+{
+    vec3 r = {.x = a.x, .y = a.y, .z = z};
+    return r;
+}
+
+
+static inline vec4 toVec4(vec3 a, float w)
+{
+    vec4 r;
+#ifdef VECMATH_SSE
+    r.m = _mm_set_ps(w, a.z, a.y, a.x);
+#else
+    r.f[0] = a.x;
+    r.f[1] = a.y;
+    r.f[2] = a.z;
+    r.f[3] = w;
+#endif
+    return r;
+}
+
+static inline vec3 dropW(vec4 a)
+{
+    vec3 r = {.x = a.f[0], .y = a.f[1], .z = a.f[2]};
+    return r;
+}
+
+static inline vec4 add4(vec4 a, vec4 b)
+{
+#ifdef VECMATH_SSE
+    a.m = _mm_add_ps(a.m, b.m);
+#else
+    int i;
+    for(i=0;i < 4;i++)
+        a.f[i] += b.f[i];
+#endif
+    return a;
+}
+
+static inline vec4 sub4(vec4 a, vec4 b)
+{
+#ifdef VECMATH_SSE
+    a.m = _mm_sub_ps(a.m, b.m);
+#else
+    int i;
+    for(i=0;i < 4;i++)
+        a.f[i] -= b.f[i];
+#endif
+    return a;
+}
+
+static inline vec4 mul4(vec4 a, float b)
+{
+#ifdef VECMATH_SSE
+    a.m = _mm_mul_ps(a.m, _mm_set1_ps(b));
+#else
+    int i;
+    for(i=0;i < 4;i++)
+        a.f[i] *= b;
+#endif
+    return a;
+}
+
+static inline float dot4(vec4 a, vec4 b)
+{
+#ifdef VECMATH_SSE
+    __m128 m = _mm_mul_ps(a.m, b.m);
+    m = _mm_add_ps(m, _mm_movehl_ps(m, m)); //x + z, y + w
+    m = _mm_add_ss(m, _mm_shuffle_ps(m, m, 1));
+    return _mm_cvtss_f32(m);
+#else
+    return (a.f[0] * b.f[0]) + (a.f[1] * b.f[1]) + (a.f[2] * b.f[2]) + (a.f[3] * b.f[3]);
+#endif
+}
+
+
+static inline mat3 mat3RotateZ(float theta) //same rotation as rotateZ
+{
+    float s = sinf(theta);
+    float c = cosf(theta);
+    mat3 r = {{c, -s, 0}, {s, c, 0}, {0, 0, 1}};
+    return r;
+}
+
+static inline mat3 mat3RotateX(float theta) //same rotation as rotateX
+{
+    float s = sinf(theta);
+    float c = cosf(theta);
+    mat3 r = {{1, 0, 0}, {0, c, -s}, {0, s, c}};
+    return r;
+}
+
+static inline mat3 mat3Scale(mat3 m, float s)
+{
+    mat3 r = {mul(m.x, s), mul(m.y, s), mul(m.z, s)};
+    return r;
+}
+
+static inline mat3 mat3Transpose(mat3 m)
+{
+    mat3 r = {{m.x.x, m.y.x, m.z.x}, {m.x.y, m.y.y, m.z.y}, {m.x.z, m.y.z, m.z.z}};
+    return r;
+}
+
+static inline vec3 mat3Apply(mat3 m, vec3 a)
+{
+    vec3 r = {.x = dot(m.x, a), .y = dot(m.y, a), .z = dot(m.z, a)};
+    return r;
+}
+
+static inline mat3 mat3Mul(mat3 a, mat3 b) //applying the result is the same as applying b then a
+{
+    mat3 t = mat3Transpose(b);
+    mat3 r = {mat3Apply(t, a.x), mat3Apply(t, a.y), mat3Apply(t, a.z)};
+    return r;
+}
+
+
+static inline mat4 mat4FromMat3(mat3 m, vec3 translation)
+{
+    mat4 r;
+    mat3 t = mat3Transpose(m);
+    r.c[0] = toVec4(t.x, 0);
+    r.c[1] = toVec4(t.y, 0);
+    r.c[2] = toVec4(t.z, 0);
+    r.c[3] = toVec4(translation, 1);
+    return r;
+}
+
+static inline vec4 mat4Apply(mat4 m, vec4 a)
+{
+#ifdef VECMATH_SSE
+    vec4 r;
+    r.m = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m.c[0].m, _mm_shuffle_ps(a.m, a.m, 0x00)), _mm_mul_ps(m.c[1].m, _mm_shuffle_ps(a.m, a.m, 0x55))),
+                     _mm_add_ps(_mm_mul_ps(m.c[2].m, _mm_shuffle_ps(a.m, a.m, 0xaa)), _mm_mul_ps(m.c[3].m, _mm_shuffle_ps(a.m, a.m, 0xff))));
+    return r;
+#else
+    return add4(add4(mul4(m.c[0], a.f[0]), mul4(m.c[1], a.f[1])), add4(mul4(m.c[2], a.f[2]), mul4(m.c[3], a.f[3])));
+#endif
+}
+
+static inline vec3 mat4ApplyPoint(mat4 m, vec3 a) //a with w = 1, so the translation is added
+{
+    return dropW(mat4Apply(m, toVec4(a, 1)));
+}
+
+static inline mat4 mat4Mul(mat4 a, mat4 b) //applying the result is the same as applying b then a
+{
+    mat4 r;
+    int i;
+    for(i=0;i < 4;i++)
+        r.c[i] = mat4Apply(a, b.c[i]);
+    return r;
+}
+
+#endif